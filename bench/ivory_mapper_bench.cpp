@@ -0,0 +1,363 @@
+// Copyright (c) 2021 Lovro Vrcek
+
+#include <algorithm>
+#include <climits>
+#include <random>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "aligner.hpp"
+#include "minimizer.hpp"
+
+#include "benchmark/benchmark.h"
+
+namespace {
+
+const unsigned int kKmerLen = 15;
+const unsigned int kWindowLen = 10;
+const unsigned int kGenomeLen = 2000000;
+const unsigned int kReadLen = 5000;
+const unsigned int kNumReads = 100;
+
+// Per base rates of the errors introduced into simulated reads
+struct ErrorProfile {
+    const char* name;
+    double substitution;
+    double insertion;
+    double deletion;
+};
+
+const ErrorProfile kErrorProfiles[] = {
+    {"exact", 0.0, 0.0, 0.0},
+    {"hifi", 0.001, 0.0005, 0.0005},
+    {"ont", 0.04, 0.03, 0.03},
+    {"clr", 0.01, 0.06, 0.04},
+};
+const int kNumErrorProfiles = sizeof(kErrorProfiles) / sizeof(ErrorProfile);
+
+// Reads too divergent for the sparse seeds of the main index
+const ErrorProfile kDivergentProfile = {"divergent", 0.15, 0.05, 0.05};
+const unsigned int kDivergentReadLen = 1000;
+const unsigned int kRescueWindowLen = 5;
+
+const char* kAlignmentTypes[] = {"global", "local", "semiglobal"};
+
+std::string RandomSequence(unsigned int len, std::mt19937* generator) {
+    std::string s(len, 'A');
+    for (auto& c : s)
+        c = "ACGT"[(*generator)() % 4];
+    return s;
+}
+
+// Copies the sequence while introducing errors of the profile
+std::string Mutate(const std::string& sequence, const ErrorProfile& profile,
+                   std::mt19937* generator) {
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::string mutated;
+    mutated.reserve(sequence.size() + sequence.size() / 8);
+    for (auto c : sequence) {
+        double r = uniform(*generator);
+        if (r < profile.deletion)
+            continue;
+        r -= profile.deletion;
+        if (r < profile.insertion) {
+            mutated += "ACGT"[(*generator)() % 4];
+            mutated += c;
+            continue;
+        }
+        r -= profile.insertion;
+        if (r < profile.substitution) {
+            const char* bases = "ACGT";
+            unsigned int code = std::string(bases).find(c);
+            mutated += bases[(code + 1 + (*generator)() % 3) % 4];
+            continue;
+        }
+        mutated += c;
+    }
+    return mutated;
+}
+
+// Reads sampled from random positions of both strands of the genome, the
+// positions are stored if not null
+std::vector<std::string> SimulateReads(
+        const std::string& genome,
+        unsigned int num_reads,
+        unsigned int read_len,
+        const ErrorProfile& profile,
+        unsigned int seed,
+        std::vector<unsigned int>* positions = nullptr) {
+    std::mt19937 generator(seed);
+    std::vector<std::string> reads;
+    for (unsigned int i = 0; i < num_reads; i++) {
+        unsigned int pos = generator() % (genome.size() - read_len);
+        if (positions != nullptr)
+            positions->push_back(pos);
+        std::string read = Mutate(genome.substr(pos, read_len), profile,
+                                  &generator);
+        if (generator() % 2 == 0)
+            read = ivory::ReverseComplement(read);
+        reads.emplace_back(std::move(read));
+    }
+    return reads;
+}
+
+// The genome and its filtered index are generated once and shared
+const std::string& Genome() {
+    static const std::string genome = [] () {
+        std::mt19937 generator(42);
+        return RandomSequence(kGenomeLen, &generator);
+    }();
+    return genome;
+}
+
+const ivory::Lookup& GenomeLookup() {
+    static const ivory::Lookup lookup = [] () {
+        ivory::Lookup lookup;
+        ivory::Minimize({Genome().c_str()}, {kGenomeLen},
+                        kKmerLen, kWindowLen, &lookup);
+        ivory::Filter(0.001, &lookup);
+        return lookup;
+    }();
+    return lookup;
+}
+
+// Args: alignment type, sequence length, affine gaps
+void BM_Align(benchmark::State& state) {
+    ivory::AlignmentType type = static_cast<ivory::AlignmentType>(
+            state.range(0));
+    unsigned int len = state.range(1);
+    bool affine = state.range(2) != 0;
+
+    std::mt19937 generator(len);
+    std::string target = RandomSequence(len, &generator);
+    std::string query = Mutate(target, kErrorProfiles[2], &generator);
+    std::string cigar;
+    unsigned int target_begin;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(ivory::Align(
+                query.c_str(), query.size(), target.c_str(), target.size(),
+                type, 3, -5, -4, affine ? -8 : 0, affine ? -2 : 0,
+                &cigar, &target_begin));
+    }
+    state.SetLabel(std::string(kAlignmentTypes[type]) +
+                   (affine ? "/affine" : "/linear"));
+    state.counters["cells"] = benchmark::Counter(
+            static_cast<double>(query.size()) * target.size(),
+            benchmark::Counter::kIsIterationInvariantRate);
+}
+
+void AlignArguments(benchmark::internal::Benchmark* b) {
+    for (int type = 0; type < 3; type++) {
+        for (int len = 64; len <= 512; len *= 2) {
+            for (int affine = 0; affine < 2; affine++)
+                b->Args({type, len, affine});
+        }
+    }
+}
+
+BENCHMARK(BM_Align)->Apply(AlignArguments)->Unit(benchmark::kMicrosecond);
+
+// Args: error profile
+void BM_AlignChain(benchmark::State& state) {
+    const ErrorProfile& profile = kErrorProfiles[state.range(0)];
+    std::vector<std::string> reads = SimulateReads(Genome(), 20, kReadLen,
+                                                   profile, 7);
+
+    // Chains are found outside of the timed loop, reverse strand reads are
+    // aligned to the reverse complement of the target like in the mapper
+    struct Job {
+        const std::string* query;
+        std::string target;
+        std::vector<std::pair<unsigned int, unsigned int>> anchors;
+    };
+    std::vector<Job> jobs;
+    for (auto& read : reads) {
+        auto overlaps = ivory::Map(read.c_str(), read.size(), GenomeLookup(),
+                                   kKmerLen, kWindowLen);
+        if (overlaps.empty())
+            continue;
+        ivory::Overlap& o = overlaps.front();
+        Job job;
+        job.query = &read;
+        job.target = Genome();
+        job.anchors = o.anchors;
+        if (!o.strand) {
+            job.target = ivory::ReverseComplement(job.target);
+            for (auto& it : job.anchors)
+                it.second = kGenomeLen - it.second - kKmerLen;
+            std::reverse(job.anchors.begin(), job.anchors.end());
+        }
+        jobs.emplace_back(std::move(job));
+    }
+
+    std::string cigar;
+    std::size_t bases = 0;
+    for (auto& it : jobs)
+        bases += it.query->size();
+    for (auto _ : state) {
+        for (auto& it : jobs) {
+            benchmark::DoNotOptimize(ivory::AlignChain(
+                    it.query->c_str(), it.query->size(),
+                    it.target.c_str(), it.target.size(),
+                    it.anchors, kKmerLen, 3, -5, -4, &cigar));
+        }
+    }
+    state.SetLabel(profile.name);
+    state.counters["bases"] = benchmark::Counter(
+            bases, benchmark::Counter::kIsIterationInvariantRate);
+    state.counters["reads"] = benchmark::Counter(
+            jobs.size(), benchmark::Counter::kIsIterationInvariantRate);
+}
+
+BENCHMARK(BM_AlignChain)->DenseRange(0, kNumErrorProfiles - 1)
+                        ->Unit(benchmark::kMillisecond);
+
+// Args: sequence length
+void BM_Minimize(benchmark::State& state) {
+    unsigned int len = state.range(0);
+    const char* sequence = Genome().c_str();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(ivory::Minimize(sequence, len,
+                                                 kKmerLen, kWindowLen));
+    }
+    state.counters["bases"] = benchmark::Counter(
+            len, benchmark::Counter::kIsIterationInvariantRate);
+}
+
+BENCHMARK(BM_Minimize)->RangeMultiplier(10)->Range(1000, 1000000)
+                      ->Unit(benchmark::kMicrosecond);
+
+// Index build over sequences of the given length, args: sequence length
+void BM_MinimizeIndex(benchmark::State& state) {
+    unsigned int len = state.range(0);
+    std::vector<const char*> sequences;
+    std::vector<unsigned int> sequence_lens;
+    for (unsigned int begin = 0; begin + len <= kGenomeLen; begin += len) {
+        sequences.push_back(Genome().c_str() + begin);
+        sequence_lens.push_back(len);
+    }
+    for (auto _ : state) {
+        ivory::Lookup lookup;
+        ivory::Minimize(sequences, sequence_lens, kKmerLen, kWindowLen,
+                        &lookup);
+        benchmark::DoNotOptimize(lookup.size());
+    }
+    state.counters["bases"] = benchmark::Counter(
+            static_cast<double>(len) * sequences.size(),
+            benchmark::Counter::kIsIterationInvariantRate);
+}
+
+BENCHMARK(BM_MinimizeIndex)->Arg(10000)->Arg(kGenomeLen)
+                           ->Unit(benchmark::kMillisecond);
+
+// Args: frequency in units of 1e-4
+void BM_Filter(benchmark::State& state) {
+    double frequency = state.range(0) * 1e-4;
+    ivory::Lookup lookup;
+    ivory::Minimize({Genome().c_str()}, {kGenomeLen}, kKmerLen, kWindowLen,
+                    &lookup);
+    for (auto _ : state) {
+        state.PauseTiming();
+        ivory::Lookup copy = lookup;
+        state.ResumeTiming();
+        ivory::Filter(frequency, &copy);
+        benchmark::DoNotOptimize(copy.size());
+    }
+    state.counters["minimizers"] = benchmark::Counter(
+            lookup.size(), benchmark::Counter::kIsIterationInvariantRate);
+}
+
+BENCHMARK(BM_Filter)->Arg(10)->Arg(100)->Unit(benchmark::kMillisecond);
+
+// Queries of simulated reads against the genome index, args: error profile
+void BM_Map(benchmark::State& state) {
+    const ErrorProfile& profile = kErrorProfiles[state.range(0)];
+    std::vector<std::string> reads = SimulateReads(Genome(), kNumReads,
+                                                   kReadLen, profile, 11);
+    const ivory::Lookup& lookup = GenomeLookup();
+
+    std::size_t bases = 0;
+    for (auto& it : reads)
+        bases += it.size();
+    for (auto _ : state) {
+        for (auto& it : reads) {
+            benchmark::DoNotOptimize(ivory::Map(it.c_str(), it.size(), lookup,
+                                                kKmerLen, kWindowLen));
+        }
+    }
+    state.SetLabel(profile.name);
+    state.counters["bases"] = benchmark::Counter(
+            bases, benchmark::Counter::kIsIterationInvariantRate);
+    state.counters["reads"] = benchmark::Counter(
+            reads.size(), benchmark::Counter::kIsIterationInvariantRate);
+}
+
+BENCHMARK(BM_Map)->DenseRange(0, kNumErrorProfiles - 1)
+                 ->Unit(benchmark::kMillisecond);
+
+// Queries of divergent reads, which are seeded again with the rescue index
+// of the given k-mer size if their best chain spans less than 80% of them.
+// Besides the speed, reports how many reads the rescue is tried on, how
+// many map to their origin and how many across 80% of their length, args:
+// rescue k-mer size (0 for none)
+void BM_MapRescue(benchmark::State& state) {
+    unsigned int rescue_kmer_len = state.range(0);
+    std::vector<unsigned int> positions;
+    std::vector<std::string> reads = SimulateReads(
+            Genome(), kNumReads, kDivergentReadLen, kDivergentProfile, 13,
+            &positions);
+    const ivory::Lookup& lookup = GenomeLookup();
+    ivory::RescueIndex rescue;
+    rescue.kmer_len = rescue_kmer_len;
+    rescue.window_len = kRescueWindowLen;
+    if (rescue_kmer_len > 0) {
+        ivory::Minimize({Genome().c_str()}, {kGenomeLen},
+                        rescue.kmer_len, rescue.window_len, &rescue.lookup);
+        ivory::Filter(0.001, &rescue.lookup);
+    }
+
+    auto span = [] (const ivory::Overlap& o) { return o.q_end - o.q_begin; };
+    std::size_t bases = 0, tried = 0, located = 0, full = 0;
+    for (std::size_t i = 0; i < reads.size(); i++) {
+        const std::string& read = reads[i];
+        bases += read.size();
+        auto overlaps = ivory::Map(read.c_str(), read.size(), lookup,
+                                   kKmerLen, kWindowLen);
+        if (rescue_kmer_len > 0 && (overlaps.empty() ||
+                span(overlaps.front()) < read.size() * 0.8)) {
+            tried++;
+            overlaps = ivory::Map(read.c_str(), read.size(), lookup,
+                                  kKmerLen, kWindowLen, UINT_MAX, nullptr, 0,
+                                  0, &rescue);
+        }
+        if (overlaps.empty())
+            continue;
+        const ivory::Overlap& o = overlaps.front();
+        located += o.t_begin < positions[i] + kDivergentReadLen &&
+                o.t_end > positions[i];
+        full += span(o) >= read.size() * 0.8;
+    }
+
+    for (auto _ : state) {
+        for (auto& it : reads) {
+            benchmark::DoNotOptimize(ivory::Map(
+                    it.c_str(), it.size(), lookup, kKmerLen, kWindowLen,
+                    UINT_MAX, nullptr, 0, 0,
+                    rescue_kmer_len > 0 ? &rescue : nullptr));
+        }
+    }
+    state.SetLabel(rescue_kmer_len > 0 ? "rescue" : "main");
+    state.counters["bases"] = benchmark::Counter(
+            bases, benchmark::Counter::kIsIterationInvariantRate);
+    state.counters["tried"] = tried;
+    state.counters["located"] = located;
+    state.counters["full"] = full;
+}
+
+BENCHMARK(BM_MapRescue)->Arg(0)->Arg(11)->Unit(benchmark::kMillisecond);
+
+}  // namespace
+
+BENCHMARK_MAIN();
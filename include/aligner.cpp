@@ -8,12 +8,134 @@
 #include <string>
 #include <vector>
 #include <algorithm>
+#include <climits>
 #include <utility>
 
+#include "profile.hpp"
 
 
 namespace ivory {
 
+namespace {
+
+// Diagonals added on both sides of the band of gaps and end extensions
+const int kGapBand = 50;
+const int kExtensionBand = kChainExtension;
+const int kNegativeInfinity = INT_MIN / 2;
+
+// Storage of a banded matrix, reused between the pieces of one alignment
+struct BandedMatrix {
+    std::vector<int> score;
+    std::vector<unsigned char> traceback;
+};
+
+// Turns a sequence of operations into a CIGAR string, e.g. MMMID -> 3M1I1D
+std::string RunLengthEncode(const std::string& ops) {
+    std::string cigar = "";
+    for (std::size_t i = 0, j = 0; i < ops.size(); i = j) {
+        while (j < ops.size() && ops[j] == ops[i])
+            j++;
+        cigar += std::to_string(j - i) + ops[i];
+    }
+    return cigar;
+}
+
+// Aligns query[0, query_len) to target[0, target_len) with linear gaps,
+// computing only the cells with diagonal j - i in [lo, hi]. The alignment
+// either ends in the last cell, or is an extension ending in the best
+// scoring cell. Operations are appended to ops in order, in the SAM
+// convention where I consumes the query and D the target.
+int BandedAlignment(
+        const char* query, unsigned int query_len,
+        const char* target, unsigned int target_len,
+        int lo, int hi,
+        bool extension,
+        int match,
+        int mismatch,
+        int gap,
+        BandedMatrix* matrix,
+        std::string* ops,
+        unsigned int* query_end,
+        unsigned int* target_end) {
+    int n = query_len, m = target_len;
+    std::size_t width = hi - lo + 1;
+    IVORY_COUNT(kCells, (n + 1) * width);
+    matrix->score.assign((n + 1) * width, kNegativeInfinity);
+    matrix->traceback.assign((n + 1) * width, stop);
+    auto cell = [lo, width] (int i, int j) {
+        return i * width + (j - i - lo);
+    };
+
+    int best = 0, end_i = 0, end_j = 0;
+    for (int i = 0; i < n + 1; i++) {
+        for (int j = std::max(0, i + lo); j <= std::min(m, i + hi); j++) {
+            int score = i == 0 && j == 0 ? 0 : kNegativeInfinity;
+            Direction direction = stop;
+            if (i > 0 && j > 0) {
+                int subs = matrix->score[cell(i-1, j-1)] +
+                        ((query[i-1] == target[j-1]) ? match : mismatch);
+                if (subs > score) {
+                    score = subs;
+                    direction = diag;
+                }
+            }
+            if (j > 0 && j - 1 - i >= lo) {
+                int ins = matrix->score[cell(i, j-1)] + gap;
+                if (ins > score) {
+                    score = ins;
+                    direction = left;
+                }
+            }
+            if (i > 0 && j - i + 1 <= hi) {
+                int del = matrix->score[cell(i-1, j)] + gap;
+                if (del > score) {
+                    score = del;
+                    direction = up;
+                }
+            }
+            matrix->score[cell(i, j)] = score;
+            matrix->traceback[cell(i, j)] = direction;
+
+            if (extension && score > best) {
+                best = score;
+                end_i = i;
+                end_j = j;
+            }
+        }
+    }
+    if (!extension) {
+        best = matrix->score[cell(n, m)];
+        end_i = n;
+        end_j = m;
+    }
+
+    std::size_t ops_begin = ops->size();
+    for (int i = end_i, j = end_j; i > 0 || j > 0;) {
+        switch (matrix->traceback[cell(i, j)]) {
+            case diag:
+                *ops += 'M';
+                i--;
+                j--;
+                break;
+            case left:
+                *ops += 'D';
+                j--;
+                break;
+            default:
+                *ops += 'I';
+                i--;
+                break;
+        }
+    }
+    std::reverse(ops->begin() + ops_begin, ops->end());
+
+    *query_end = end_i;
+    *target_end = end_j;
+    return best;
+}
+
+}  // namespace
+
 int GlobalAlignment(
         const char* query, unsigned int query_len,
         const char* target, unsigned int target_len,
@@ -85,6 +207,13 @@ int GlobalAlignment(
     if (target_begin != nullptr)
         *target_begin = GetTargetBegin(traceback, end_query, end_target);
 
+    for (unsigned int i = 0; i < query_len + 1; i++) {
+        delete[] matrix[i];
+        delete[] traceback[i];
+    }
+    delete[] matrix;
+    delete[] traceback;
+
     return score;
 }
 
@@ -166,6 +295,13 @@ int LocalAlignment(
     if (target_begin != nullptr)
         *target_begin = GetTargetBegin(traceback, end_query, end_target);
 
+    for (unsigned int i = 0; i < query_len + 1; i++) {
+        delete[] matrix[i];
+        delete[] traceback[i];
+    }
+    delete[] matrix;
+    delete[] traceback;
+
     return score;
 }
 
@@ -247,6 +383,13 @@ int SemiGlobalAlignment(
     if (target_begin != nullptr)
         *target_begin = GetTargetBegin(traceback, end_query, end_target);
 
+    for (unsigned int i = 0; i < query_len + 1; i++) {
+        delete[] matrix[i];
+        delete[] traceback[i];
+    }
+    delete[] matrix;
+    delete[] traceback;
+
     return score;
 }
 
@@ -318,21 +461,8 @@ std::string GetCigar(Direction** traceback, unsigned int end_query,
             break;
         }
     }
-    int count = 1;
     std::reverse(cigar.begin(), cigar.end());
-    std::string new_cigar = "";
-
-    for (int i = 1; i < cigar.size(); i++) {
-        if (cigar[i] == cigar[i-1]) {
-            count++;
-        } else {
-            new_cigar += std::to_string(count) + cigar[i-1];
-            count = 1;
-        }
-    }
-    new_cigar += std::to_string(count) + cigar[cigar.size()-1];
-
-    return new_cigar;
+    return RunLengthEncode(cigar);
 }
 
 unsigned int GetTargetBegin(Direction** traceback, unsigned int end_query,
@@ -366,6 +496,7 @@ int Align(
         std::string* cigar,
         unsigned int* target_begin,
         bool matrix_print) {
+    IVORY_COUNT(kCells, (query_len + 1ULL) * (target_len + 1));
     int alignment_score;
     switch (type) {
         case global:
@@ -399,4 +530,111 @@ int Align(
     return alignment_score;
 }
 
+std::string ReverseCigar(const std::string& cigar) {
+    std::string reversed;
+    reversed.reserve(cigar.size());
+    for (std::size_t end = cigar.size(), begin; end > 0; end = begin) {
+        begin = cigar.find_last_not_of("0123456789", end - 2) + 1;
+        reversed.append(cigar, begin, end - begin);
+    }
+    return reversed;
+}
+
+std::string StandardCigar(const std::string& cigar) {
+    std::string standard = cigar;
+    for (auto& c : standard) {
+        if (c == 'I')
+            c = 'D';
+        else if (c == 'D')
+            c = 'I';
+    }
+    return standard;
+}
+
+int AlignChain(
+        const char* query, unsigned int query_len,
+        const char* target, unsigned int target_len,
+        const std::vector<std::pair<unsigned int, unsigned int>>& anchors,
+        unsigned int kmer_len,
+        int match,
+        int mismatch,
+        int gap,
+        std::string* cigar,
+        unsigned int* query_begin,
+        unsigned int* query_end,
+        unsigned int* target_begin,
+        unsigned int* target_end) {
+    if (anchors.empty())
+        return 0;
+
+    BandedMatrix matrix;
+    std::string ops, flank_ops;
+    unsigned int flank_query_len, flank_target_len;
+    int score = 0;
+
+    // Extend the left end on the reversed prefixes
+    unsigned int q = anchors.front().first, t = anchors.front().second;
+    std::string query_prefix(query, q);
+    std::string target_prefix(target + t - std::min(t, q + kExtensionBand),
+                              target + t);
+    std::reverse(query_prefix.begin(), query_prefix.end());
+    std::reverse(target_prefix.begin(), target_prefix.end());
+    score += BandedAlignment(
+            query_prefix.c_str(), query_prefix.size(),
+            target_prefix.c_str(), target_prefix.size(),
+            -kExtensionBand, kExtensionBand, true,
+            match, mismatch, gap,
+            &matrix, &flank_ops, &flank_query_len, &flank_target_len);
+    ops.assign(flank_ops.rbegin(), flank_ops.rend());
+    unsigned int aligned_query_begin = q - flank_query_len;
+    unsigned int aligned_target_begin = t - flank_target_len;
+
+    // Anchors are matches, gaps between them are aligned globally. Anchors
+    // overlapping the previous one only extend it on the same diagonal.
+    for (auto& it : anchors) {
+        unsigned int gap_query_len, gap_target_len;
+        if (it.first >= q && it.second >= t) {
+            int d = static_cast<int>(it.second - t) - static_cast<int>(it.first - q);
+            score += BandedAlignment(
+                    query + q, it.first - q,
+                    target + t, it.second - t,
+                    std::min(0, d) - kGapBand, std::max(0, d) + kGapBand, false,
+                    match, mismatch, gap,
+                    &matrix, &ops, &gap_query_len, &gap_target_len);
+            q = it.first;
+            t = it.second;
+        } else if (it.first - q != it.second - t ||
+                   it.first + kmer_len <= q) {
+            continue;
+        }
+        for (; q < it.first + kmer_len && q < query_len; q++, t++) {
+            score += (query[q] == target[t]) ? match : mismatch;
+            ops += 'M';
+        }
+    }
+
+    // Extend the right end
+    unsigned int query_suffix_len = query_len - q;
+    score += BandedAlignment(
+            query + q, query_suffix_len,
+            target + t, std::min(target_len - t,
+                                 query_suffix_len + kExtensionBand),
+            -kExtensionBand, kExtensionBand, true,
+            match, mismatch, gap,
+            &matrix, &ops, &flank_query_len, &flank_target_len);
+
+    if (cigar != nullptr)
+        *cigar = RunLengthEncode(ops);
+    if (query_begin != nullptr)
+        *query_begin = aligned_query_begin;
+    if (query_end != nullptr)
+        *query_end = q + flank_query_len;
+    if (target_begin != nullptr)
+        *target_begin = aligned_target_begin;
+    if (target_end != nullptr)
+        *target_end = t + flank_target_len;
+
+    return score;
+}
+
 }  // namespace ivory
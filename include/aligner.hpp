@@ -5,6 +5,8 @@
 
 #include <iostream>
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace ivory {
 
@@ -12,6 +14,10 @@ enum AlignmentType { global, local, semiglobal };
 
 enum Direction { up = 0, left = 1, diag = 2, stop = 3 };
 
+// Target bases beyond the unaligned query flanks which AlignChain may extend
+// the ends of a chain into
+const unsigned int kChainExtension = 100;
+
 int GlobalAlignment(
         const char* query, unsigned int query_len,
         const char* target, unsigned int target_len,
@@ -77,6 +83,36 @@ int Align(
         unsigned int* target_begin = nullptr,
         bool matrix_print = false);
 
+// Reverses the order of operations, e.g. 3M1I1D -> 1D1I3M, which turns the
+// alignment of a query to the reverse complement of a target into the
+// alignment of the reverse complemented query to the target
+std::string ReverseCigar(const std::string& cigar);
+
+// Swaps the insertions and deletions of a CIGAR of Align, in which I consumes
+// the target and D the query, into the SAM convention used in the output
+std::string StandardCigar(const std::string& cigar);
+
+// Aligns the query to the target along a chain of exact k-mer matches, given
+// as increasing (query position, target position) pairs. Anchors are taken
+// as matches, the gaps between them are aligned globally within a band and
+// both ends are extended for as long as the score improves. Unlike Align,
+// the CIGAR follows the SAM convention, where I consumes the query and D the
+// target. The aligned span is stored into the begin and end arguments, if
+// they are not nullptr.
+int AlignChain(
+        const char* query, unsigned int query_len,
+        const char* target, unsigned int target_len,
+        const std::vector<std::pair<unsigned int, unsigned int>>& anchors,
+        unsigned int kmer_len,
+        int match,
+        int mismatch,
+        int gap,
+        std::string* cigar = nullptr,
+        unsigned int* query_begin = nullptr,
+        unsigned int* query_end = nullptr,
+        unsigned int* target_begin = nullptr,
+        unsigned int* target_end = nullptr);
+
 }  // namespace ivory
 
 #endif  // INCLUDE_ALIGNER_HPP_
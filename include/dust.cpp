@@ -0,0 +1,178 @@
+// Copyright (c) 2021 Lovro Vrcek
+
+#include "dust.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <utility>
+#include <vector>
+
+
+namespace ivory {
+
+namespace {
+
+const int kWordLen = 3;
+const int kNumWords = 1 << (2 * kWordLen);
+
+// Interval whose score r over l triplets is at least the score of each of
+// its subintervals
+struct PerfectInterval {
+    long long start, finish;
+    int r, l;
+};
+
+inline int Encode(char c) {
+    switch (c) {
+        case 'A': case 'a': return 0;
+        case 'C': case 'c': return 1;
+        case 'G': case 'g': return 2;
+        case 'T': case 't': return 3;
+        default: return 4;
+    }
+}
+
+// Scores of the triplets in the current window, updated as it slides. The
+// last L triplets form the longest suffix whose score stays under the
+// threshold, with counts cv and score rv, while cw and rw cover the whole
+// window. Perfect intervals are kept in decreasing order of start.
+class DustWindow {
+ public:
+    DustWindow(int threshold, int window_len)
+            : threshold_(threshold),
+              window_len_(window_len) {
+        Reset();
+    }
+
+    void Reset() {
+        words_.clear();
+        std::memset(cw_, 0, sizeof(cw_));
+        std::memset(cv_, 0, sizeof(cv_));
+        rw_ = rv_ = L_ = 0;
+    }
+
+    void Shift(int t) {
+        if (static_cast<int>(words_.size()) >= window_len_ - kWordLen + 1) {
+            int s = words_.front();
+            words_.pop_front();
+            rw_ -= --cw_[s];
+            if (L_ > static_cast<int>(words_.size())) {
+                --L_;
+                rv_ -= --cv_[s];
+            }
+        }
+        words_.push_back(t);
+        ++L_;
+        rw_ += cw_[t]++;
+        rv_ += cv_[t]++;
+        if (cv_[t] * 10 > threshold_ * 2) {
+            int s;
+            do {
+                s = words_[words_.size() - L_];
+                rv_ -= --cv_[s];
+                --L_;
+            } while (s != t);
+        }
+    }
+
+    bool IsDusty() const {
+        return rw_ * 10 > L_ * threshold_;
+    }
+
+    // Extends the suffix to the left, storing the intervals which score
+    // above the threshold and at least as high as the perfect intervals
+    // they contain
+    void FindPerfect(long long start,
+                     std::vector<PerfectInterval>* perfect) const {
+        int c[kNumWords];
+        std::memcpy(c, cv_, sizeof(c));
+        int r = rv_, max_r = 0, max_l = 0;
+        int n = words_.size();
+        for (int i = n - L_ - 1; i >= 0; --i) {
+            int t = words_[i];
+            r += c[t]++;
+            int new_r = r, new_l = n - i - 1;
+            if (new_r * 10 <= threshold_ * new_l)
+                continue;
+            std::size_t j = 0;
+            for (; j < perfect->size() && (*perfect)[j].start >= i + start; ++j) {  // NOLINT
+                const PerfectInterval& p = (*perfect)[j];
+                if (max_r == 0 || p.r * max_l > max_r * p.l) {
+                    max_r = p.r;
+                    max_l = p.l;
+                }
+            }
+            if (max_r == 0 || new_r * max_l >= max_r * new_l) {
+                max_r = new_r;
+                max_l = new_l;
+                PerfectInterval p = {i + start, n + kWordLen - 1 + start,
+                                     new_r, new_l};
+                perfect->insert(perfect->begin() + j, p);
+            }
+        }
+    }
+
+ private:
+    int threshold_;
+    int window_len_;
+    std::deque<int> words_;
+    int cw_[kNumWords];
+    int cv_[kNumWords];
+    int rw_, rv_, L_;
+};
+
+// Moves the perfect interval with the lowest start to the result once it
+// starts before the window, merging it with the last overlapping one
+void SaveMasked(long long start, std::vector<PerfectInterval>* perfect,
+                std::vector<std::pair<unsigned int, unsigned int>>* masked) {
+    if (perfect->empty() || perfect->back().start >= start)
+        return;
+    const PerfectInterval& p = perfect->back();
+    if (!masked->empty() && p.start <= masked->back().second) {
+        masked->back().second = std::max<long long>(masked->back().second,
+                                                    p.finish);
+    } else {
+        masked->emplace_back(p.start, p.finish);
+    }
+    while (!perfect->empty() && perfect->back().start < start)
+        perfect->pop_back();
+}
+
+}  // namespace
+
+std::vector<std::pair<unsigned int, unsigned int>> Dust(
+        const char* sequence, unsigned int sequence_len,
+        unsigned int threshold,
+        unsigned int window_len) {
+    std::vector<std::pair<unsigned int, unsigned int>> masked;
+    std::vector<PerfectInterval> perfect;
+    DustWindow window(threshold, window_len);
+    long long w = window_len;
+    long long l = 0;  // length of the current run of A, C, G and T
+    int t = 0;  // last triplet
+
+    for (long long i = 0; i <= sequence_len; i++) {
+        int b = i < sequence_len ? Encode(sequence[i]) : 4;
+        if (b < 4) {
+            ++l;
+            t = ((t << 2) | b) & (kNumWords - 1);
+            if (l < kWordLen)
+                continue;
+            long long start = std::max(l - w, 0LL) + (i + 1 - l);
+            SaveMasked(start, &perfect, &masked);
+            window.Shift(t);
+            if (window.IsDusty())
+                window.FindPerfect(start, &perfect);
+        } else {
+            long long start = std::max(l - w + 1, 0LL) + (i + 1 - l);
+            while (!perfect.empty())
+                SaveMasked(start++, &perfect, &masked);
+            window.Reset();
+            l = t = 0;
+        }
+    }
+    return masked;
+}
+
+}  // namespace ivory
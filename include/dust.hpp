@@ -0,0 +1,23 @@
+// Copyright (c) 2021 Lovro Vrcek
+
+#ifndef INCLUDE_DUST_HPP_
+#define INCLUDE_DUST_HPP_
+
+#include <utility>
+#include <vector>
+
+namespace ivory {
+
+// Low complexity intervals [begin, end) of the sequence in increasing
+// order, found by the symmetric DUST algorithm (Morgulis et al. 2006). A
+// subsequence of at most window_len bases is masked if the triplet
+// repetition score of it and all of its parts exceeds threshold / 10 per
+// triplet, bases other than A, C, G and T split the sequence.
+std::vector<std::pair<unsigned int, unsigned int>> Dust(
+    const char* sequence, unsigned int sequence_len,
+    unsigned int threshold = 20,
+    unsigned int window_len = 64);
+
+}  // namespace ivory
+
+#endif  // INCLUDE_DUST_HPP_
@@ -0,0 +1,351 @@
+// Copyright (c) 2021 Lovro Vrcek
+
+#include "evaluation.hpp"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <list>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+
+namespace ivory {
+
+namespace {
+
+const std::size_t kBlockSize = 1 << 20;
+
+struct PafGroup {
+    std::string query;
+    std::vector<PafOverlap> overlaps;
+};
+
+// Parses a decimal field, returns false if it is not a number
+bool ParseUnsigned(const char* begin, const char* end, unsigned int* value) {
+    if (begin == end)
+        return false;
+    unsigned long long v = 0;
+    for (const char* p = begin; p < end; p++) {
+        if (*p < '0' || *p > '9')
+            return false;
+        v = v * 10 + (*p - '0');
+    }
+    *value = v;
+    return true;
+}
+
+// Reads a PAF file one query at a time
+class PafStream {
+ public:
+    explicit PafStream(const std::string& path)
+            : path_(path),
+              file_(gzopen(path.c_str(), "r")),
+              begin_(0),
+              eof_(false),
+              has_next_(false) {
+        if (file_ == nullptr) {
+            throw std::invalid_argument(
+                    "[ivory::ComparePaf] error: unable to open file " + path);
+        }
+        gzbuffer(file_, 1 << 17);
+    }
+
+    PafStream(const PafStream&) = delete;
+    PafStream& operator=(const PafStream&) = delete;
+
+    ~PafStream() {
+        gzclose(file_);
+    }
+
+    // Returns false at the end of the file, throws if the query was already
+    // returned, i.e. its lines are not consecutive
+    bool NextGroup(PafGroup* group) {
+        group->query.clear();
+        group->overlaps.clear();
+        if (has_next_) {
+            group->query.swap(next_query_);
+            group->overlaps.emplace_back(std::move(next_overlap_));
+            has_next_ = false;
+        }
+
+        const char* line;
+        std::size_t len;
+        while (NextLine(&line, &len)) {
+            if (len == 0)
+                continue;
+            if (!ParsePafLine(line, len, &next_query_, &next_overlap_)) {
+                throw std::runtime_error(
+                        "[ivory::ComparePaf] error: invalid line in " + path_);
+            }
+            if (group->overlaps.empty()) {
+                group->query.swap(next_query_);
+                group->overlaps.emplace_back(std::move(next_overlap_));
+            } else if (next_query_ == group->query) {
+                group->overlaps.emplace_back(std::move(next_overlap_));
+            } else {
+                has_next_ = true;
+                break;
+            }
+        }
+        if (group->overlaps.empty())
+            return false;
+        if (!seen_.insert(std::hash<std::string>()(group->query)).second) {
+            throw std::runtime_error(
+                    "[ivory::ComparePaf] error: lines of " + group->query +
+                    " are not consecutive in " + path_);
+        }
+        return true;
+    }
+
+ private:
+    bool NextLine(const char** line, std::size_t* len) {
+        while (true) {
+            const char* begin = buffer_.data() + begin_;
+            const char* end = buffer_.data() + buffer_.size();
+            const char* newline = static_cast<const char*>(
+                    std::memchr(begin, '\n', end - begin));
+            if (newline != nullptr || (eof_ && begin < end)) {
+                *line = begin;
+                *len = (newline != nullptr ? newline : end) - begin;
+                begin_ += *len + (newline != nullptr);
+                if (*len > 0 && begin[*len - 1] == '\r')
+                    --*len;
+                return true;
+            }
+            if (eof_)
+                return false;
+
+            buffer_.erase(0, begin_);
+            begin_ = 0;
+            std::size_t size = buffer_.size();
+            buffer_.resize(size + kBlockSize);
+            int n = gzread(file_, &buffer_[size], kBlockSize);
+            if (n < 0) {
+                throw std::runtime_error(
+                        "[ivory::ComparePaf] error: unable to read " + path_);
+            }
+            buffer_.resize(size + n);
+            eof_ = n == 0;
+        }
+    }
+
+    std::string path_;
+    gzFile file_;
+    std::string buffer_;
+    std::size_t begin_;
+    bool eof_;
+    bool has_next_;  // next_query_ and next_overlap_ hold a read line
+    std::string next_query_;
+    PafOverlap next_overlap_;
+    // Hashes of the queries read so far, rather than their names, to keep
+    // the memory small
+    std::unordered_set<std::size_t> seen_;
+};
+
+// Queries of one file not yet found in the other one, in file order
+struct PendingGroups {
+    std::list<PafGroup> groups;
+    std::unordered_map<std::string, std::list<PafGroup>::iterator> index;
+
+    void PopFront() {
+        index.erase(groups.front().query);
+        groups.pop_front();
+    }
+};
+
+void Record(const std::string& query,
+            const std::vector<PafOverlap>* baseline,
+            const std::vector<PafOverlap>* compared,
+            unsigned int epsilon,
+            Evaluation* evaluation,
+            std::ostream* mismatches) {
+    std::size_t num_baseline = baseline == nullptr ? 0 : baseline->size();
+    std::size_t num_compared = compared == nullptr ? 0 : compared->size();
+    std::size_t matched = baseline != nullptr && compared != nullptr ?
+            MatchOverlaps(*baseline, *compared, epsilon) : 0;
+
+    evaluation->baseline_overlaps += num_baseline;
+    evaluation->compared_overlaps += num_compared;
+    evaluation->matched_overlaps += matched;
+    evaluation->baseline_reads += num_baseline > 0;
+    evaluation->compared_reads += num_compared > 0;
+    evaluation->baseline_only_reads += num_compared == 0;
+    evaluation->compared_only_reads += num_baseline == 0;
+    if (matched < std::max(num_baseline, num_compared)) {
+        evaluation->mismatched_reads++;
+        if (mismatches != nullptr) {
+            *mismatches << query << '\t' << num_baseline << '\t'
+                        << num_compared << '\t' << matched << '\n';
+        }
+    }
+}
+
+}  // namespace
+
+bool ParsePafLine(const char* line, std::size_t len, std::string* query,
+                  PafOverlap* overlap) {
+    const char* fields[10];
+    const char* end = line + len;
+    const char* p = line;
+    int n = 0;
+    fields[n++] = p;
+    while (n < 10 && p < end) {
+        p = static_cast<const char*>(std::memchr(p, '\t', end - p));
+        if (p == nullptr)
+            p = end;
+        fields[n++] = ++p;
+    }
+    // fields[i + 1] - 1 is the end of field i
+    if (n < 10)
+        return false;
+    auto field_end = [&fields] (int i) { return fields[i + 1] - 1; };
+
+    unsigned int q_len, t_len;
+    if (fields[4] + 1 != field_end(4) ||
+            (*fields[4] != '+' && *fields[4] != '-') ||
+            !ParseUnsigned(fields[1], field_end(1), &q_len) ||
+            !ParseUnsigned(fields[2], field_end(2), &overlap->q_begin) ||
+            !ParseUnsigned(fields[3], field_end(3), &overlap->q_end) ||
+            !ParseUnsigned(fields[6], field_end(6), &t_len) ||
+            !ParseUnsigned(fields[7], field_end(7), &overlap->t_begin) ||
+            !ParseUnsigned(fields[8], field_end(8), &overlap->t_end)) {
+        return false;
+    }
+    query->assign(fields[0], field_end(0));
+    overlap->target.assign(fields[5], field_end(5));
+    overlap->strand = *fields[4] == '+';
+    return true;
+}
+
+std::size_t MatchOverlaps(const std::vector<PafOverlap>& baseline,
+                          const std::vector<PafOverlap>& compared,
+                          unsigned int epsilon) {
+    // Baseline overlaps of each (target, strand) are sorted by target begin,
+    // so candidates are found by binary search
+    auto key = [] (const PafOverlap& o) {
+        return std::tie(o.target, o.strand, o.t_begin);
+    };
+    std::vector<const PafOverlap*> sorted;
+    for (auto& it : baseline)
+        sorted.push_back(&it);
+    std::sort(sorted.begin(), sorted.end(),
+              [&key] (const PafOverlap* a, const PafOverlap* b) {
+                  return key(*a) < key(*b);
+              });
+    std::vector<bool> used(sorted.size(), false);
+
+    auto close = [epsilon] (unsigned int a, unsigned int b) {
+        return (a > b ? a - b : b - a) <= epsilon;
+    };
+    std::size_t matched = 0;
+    for (auto& c : compared) {
+        PafOverlap lowest = c;
+        lowest.t_begin = c.t_begin - std::min(c.t_begin, epsilon);
+        auto it = std::lower_bound(sorted.begin(), sorted.end(), &lowest,
+                [&key] (const PafOverlap* a, const PafOverlap* b) {
+                    return key(*a) < key(*b);
+                });
+        for (; it != sorted.end(); ++it) {
+            const PafOverlap& b = **it;
+            if (b.target != c.target || b.strand != c.strand ||
+                    b.t_begin > c.t_begin + epsilon) {
+                break;
+            }
+            std::size_t i = it - sorted.begin();
+            if (!used[i] && close(b.t_end, c.t_end) &&
+                    close(b.q_begin, c.q_begin) && close(b.q_end, c.q_end)) {
+                used[i] = true;
+                matched++;
+                break;
+            }
+        }
+    }
+    return matched;
+}
+
+Evaluation ComparePaf(const std::string& baseline_path,
+                      const std::string& compared_path,
+                      unsigned int epsilon,
+                      std::ostream* mismatches,
+                      std::size_t max_pending) {
+    Evaluation evaluation;
+    PafStream baseline(baseline_path), compared(compared_path);
+    PafStream* streams[2] = {&baseline, &compared};
+    PendingGroups pending[2];
+    std::uint64_t num_groups[2] = {0, 0};
+    bool eof[2] = {false, false};
+
+    // Groups are recorded as (baseline, compared)
+    auto record = [&] (int side, const PafGroup& group,
+                       const PafGroup* other) {
+        const std::vector<PafOverlap>* overlaps[2] = {nullptr, nullptr};
+        overlaps[side] = &group.overlaps;
+        if (other != nullptr)
+            overlaps[1 - side] = &other->overlaps;
+        Record(group.query, overlaps[0], overlaps[1], epsilon, &evaluation,
+               mismatches);
+    };
+    auto flush_front = [&] (int side) {
+        record(side, pending[side].groups.front(), nullptr);
+        pending[side].PopFront();
+    };
+
+    // The file with fewer queries waiting is behind and read next, so a run
+    // of queries missing from one file only holds back the other one
+    while (!eof[0] || !eof[1]) {
+        std::size_t num_pending[2] = {pending[0].groups.size(),
+                                      pending[1].groups.size()};
+        int side;
+        if (eof[0] || eof[1])
+            side = eof[0] ? 1 : 0;
+        else if (num_pending[0] != num_pending[1])
+            side = num_pending[0] < num_pending[1] ? 0 : 1;
+        else
+            side = num_groups[0] <= num_groups[1] ? 0 : 1;
+        PafGroup group;
+        if (!streams[side]->NextGroup(&group)) {
+            eof[side] = true;
+            continue;
+        }
+        num_groups[side]++;
+
+        PendingGroups& other = pending[1 - side];
+        auto it = other.index.find(group.query);
+        if (it == other.index.end()) {
+            pending[side].groups.emplace_back(std::move(group));
+            pending[side].index[pending[side].groups.back().query] =
+                    std::prev(pending[side].groups.end());
+            // The oldest query is given up on rather than holding the files
+            if (pending[side].groups.size() > max_pending) {
+                evaluation.overflow_reads++;
+                flush_front(side);
+            }
+            continue;
+        }
+
+        // Queries before the match in either file are missing from the other
+        std::list<PafGroup>::iterator match = it->second;
+        while (other.groups.begin() != match)
+            flush_front(1 - side);
+        while (!pending[side].groups.empty())
+            flush_front(side);
+        record(side, group, &*match);
+        other.PopFront();
+    }
+    for (int side = 0; side < 2; side++) {
+        while (!pending[side].groups.empty())
+            flush_front(side);
+    }
+    return evaluation;
+}
+
+}  // namespace ivory
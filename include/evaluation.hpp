@@ -0,0 +1,81 @@
+// Copyright (c) 2021 Lovro Vrcek
+
+#ifndef INCLUDE_EVALUATION_HPP_
+#define INCLUDE_EVALUATION_HPP_
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace ivory {
+
+// Coordinates of a PAF line, without the query name
+struct PafOverlap {
+    std::string target;
+    bool strand;  // true for '+'
+    unsigned int q_begin, q_end;
+    unsigned int t_begin, t_end;
+};
+
+// Returns false if the line has fewer than nine columns
+bool ParsePafLine(const char* line, std::size_t len, std::string* query,
+                  PafOverlap* overlap);
+
+// Number of overlaps of the compared set matched one to one with baseline
+// overlaps of the same query, target and strand, whose coordinates all
+// differ by at most epsilon
+std::size_t MatchOverlaps(const std::vector<PafOverlap>& baseline,
+                          const std::vector<PafOverlap>& compared,
+                          unsigned int epsilon);
+
+struct Evaluation {
+    std::uint64_t baseline_overlaps = 0;
+    std::uint64_t compared_overlaps = 0;
+    std::uint64_t matched_overlaps = 0;
+    std::uint64_t baseline_reads = 0;  // reads with at least one overlap
+    std::uint64_t compared_reads = 0;
+    std::uint64_t baseline_only_reads = 0;
+    std::uint64_t compared_only_reads = 0;
+    std::uint64_t mismatched_reads = 0;  // reads with unmatched overlaps
+    // Reads taken to be missing from the other file once too many queries
+    // were waiting for it, which may have been found later
+    std::uint64_t overflow_reads = 0;
+
+    double precision() const {
+        return compared_overlaps == 0 ? 1.0 :
+                static_cast<double>(matched_overlaps) / compared_overlaps;
+    }
+
+    double recall() const {
+        return baseline_overlaps == 0 ? 1.0 :
+                static_cast<double>(matched_overlaps) / baseline_overlaps;
+    }
+
+    // Jaccard similarity of the sets of overlaps
+    double jaccard() const {
+        std::uint64_t total = baseline_overlaps + compared_overlaps -
+                matched_overlaps;
+        return total == 0 ? 1.0 :
+                static_cast<double>(matched_overlaps) / total;
+    }
+};
+
+// Compares two PAF files (can be compressed with gzip), streaming both at
+// once. The lines of a query have to be consecutive and the queries in the
+// same relative order in both files, as mappers output them for the same
+// reads, so only the queries between the last ones found in both files are
+// held in memory, at most max_pending per file. Each read with unmatched
+// overlaps is written to mismatches if not null, as its name and the number
+// of baseline, compared and matched overlaps. Throws std::invalid_argument
+// if a file can not be opened, and std::runtime_error on invalid lines or
+// if the lines of a query are not consecutive.
+Evaluation ComparePaf(const std::string& baseline_path,
+                      const std::string& compared_path,
+                      unsigned int epsilon,
+                      std::ostream* mismatches,
+                      std::size_t max_pending = 1 << 20);
+
+}  // namespace ivory
+
+#endif  // INCLUDE_EVALUATION_HPP_
@@ -1,193 +1,408 @@
+// Copyright (c) 2021 Lovro Vrcek
+
+#include "minimizer.hpp"
+
+#include <algorithm>
+#include <deque>
+#include <functional>
 #include <iostream>
+#include <stdexcept>
 #include <string>
-#include <vector>
 #include <tuple>
-#include <map>
+#include <utility>
+#include <vector>
 
-#include "aligner.hpp"
+#include "profile.hpp"
 
 
 namespace ivory {
 
-std::string ReverseComplement(std::string s) {
-    std::string rc = "";
-    for (int i = s.size() - 1; i >= 0; i--) {
-        char c = s[i];
-        switch (c) {
-            case 'c':
-            case 'C':
-                rc += "G";
-                break;
-            case 'a':
-            case 'A':
-                rc += "T";
-                break;
-            case 't':
-            case 'T':
-                rc += "A";
-                break;
-            case 'g':
-            case 'G':
-                rc += "C";
-                break;
-        }
+namespace {
+
+struct Anchor {
+    unsigned int target_id;
+    bool strand;
+    long long diagonal;
+    unsigned int q_pos;
+    unsigned int t_pos;
+};
+
+// Maximal distance between diagonals of neighbouring anchors in one chain
+const long long kBandWidth = 500;
+const unsigned int kMinChainLength = 3;
+// Reads are mapped again with the rescue index if their best chain spans
+// less than this fraction of the query
+const double kRescueSpan = 0.8;
+
+// CAGT -> 0123, complement of a base is (code ^ 2)
+inline unsigned int Encode(char c) {
+    switch (c) {
+        case 'c':
+        case 'C':
+            return 0;
+        case 'a':
+        case 'A':
+            return 1;
+        case 'g':
+        case 'G':
+            return 2;
+        case 't':
+        case 'T':
+            return 3;
+        default:
+            return 4;
     }
-    return rc;
 }
 
-unsigned int KmerHash(std::string s) {
-    std::string new_s = "";
-    for (int i = 0; i < s.size(); i++) {
-        char c = s[i];
-        // CAGT -> 0123
-        switch (c) {
-            case 'c':
-            case 'C':
-                new_s += "0";
-                break;
-            case 'a':
-            case 'A':
-                new_s += "1";
-                break;
-            case 'g':
-            case 'G':
-                new_s += "2";
-                break;
-            case 't':
-            case 'T':
-                new_s += "3";
-                break;
+inline unsigned int QuerySpan(const Overlap& o) {
+    return o.q_end - o.q_begin;
+}
+
+// Chain ordering key, the query positions have to increase along the chain
+// on the same strand and decrease on the opposite one
+inline long long ChainKey(const Anchor& a) {
+    return a.strand ? a.q_pos : -static_cast<long long>(a.q_pos);
+}
+
+// Longest increasing subsequence on anchors [begin, end) sorted by target
+// position, returns the chain in increasing target order
+std::vector<std::size_t> LongestChain(const std::vector<Anchor>& anchors,
+                                      std::size_t begin, std::size_t end) {
+    std::vector<std::size_t> tails;
+    std::vector<std::size_t> prev(end - begin, end);
+    for (std::size_t i = begin; i < end; i++) {
+        long long key = ChainKey(anchors[i]);
+        auto it = std::lower_bound(tails.begin(), tails.end(), key,
+                [&anchors] (std::size_t j, long long k) {
+                    return ChainKey(anchors[j]) < k;
+                });
+        if (it != tails.begin())
+            prev[i - begin] = *(it - 1);
+        if (it == tails.end())
+            tails.push_back(i);
+        else
+            *it = i;
+    }
+
+    std::vector<std::size_t> chain;
+    for (std::size_t i = tails.empty() ? end : tails.back(); i != end;
+            i = prev[i - begin]) {
+        chain.push_back(i);
+    }
+    std::reverse(chain.begin(), chain.end());
+    return chain;
+}
+
+// Seeds the query with its minimizers found in lookup and chains them, the
+// chains are sorted by the number of query bases they cover
+std::vector<Overlap> SeedAndChain(
+        const char* sequence, unsigned int sequence_len,
+        const Lookup& lookup,
+        unsigned int kmer_len,
+        unsigned int window_len,
+        unsigned int target_limit,
+        const char* quality,
+        unsigned int quality_len,
+        unsigned int min_quality) {
+    std::vector<Overlap> overlaps;
+
+    std::vector<std::tuple<unsigned int, unsigned int, bool>> minimizers;
+    {
+        IVORY_TIME(kMinimizeStage);
+        minimizers = Minimize(sequence, sequence_len, quality, quality_len,
+                              min_quality, kmer_len, window_len);
+    }
+    IVORY_COUNT(kMinimizers, minimizers.size());
+
+    std::vector<Anchor> anchors;
+    {
+        IVORY_TIME(kLookupStage);
+        for (auto& m : minimizers) {
+            IVORY_COUNT(kIndexLookups, 1);
+            auto it = lookup.find(std::get<0>(m));
+            if (it == lookup.end()) {
+                IVORY_COUNT(kFilteredLookups, 1);
+                continue;
+            }
+            unsigned int q_pos = std::get<1>(m);
+            for (auto& t : it->second) {
+                if (std::get<0>(t) >= target_limit)
+                    continue;
+                Anchor a;
+                a.target_id = std::get<0>(t);
+                a.strand = std::get<1>(t) == std::get<2>(m);
+                a.q_pos = q_pos;
+                a.t_pos = std::get<2>(t);
+                a.diagonal = a.strand ?
+                        static_cast<long long>(a.t_pos) - a.q_pos :
+                        static_cast<long long>(a.t_pos) + a.q_pos;
+                anchors.push_back(a);
+            }
+        }
+    }
+    IVORY_COUNT(kAnchors, anchors.size());
+
+    IVORY_TIME(kChainStage);
+
+    // Group the matches of each (target, strand) pair into clusters of close
+    // diagonals, then take the longest increasing chain of each cluster
+    std::sort(anchors.begin(), anchors.end(),
+            [] (const Anchor& a, const Anchor& b) {
+                return std::tie(a.target_id, a.strand, a.diagonal) <
+                       std::tie(b.target_id, b.strand, b.diagonal);
+            });
+
+    for (std::size_t begin = 0, end = 1; begin < anchors.size(); begin = end++) {
+        while (end < anchors.size() &&
+                anchors[end].target_id == anchors[begin].target_id &&
+                anchors[end].strand == anchors[begin].strand &&
+                anchors[end].diagonal - anchors[end - 1].diagonal <= kBandWidth) {
+            end++;
+        }
+        if (end - begin < kMinChainLength)
+            continue;
+
+        std::sort(anchors.begin() + begin, anchors.begin() + end,
+                [] (const Anchor& a, const Anchor& b) {
+                    if (a.t_pos != b.t_pos)
+                        return a.t_pos < b.t_pos;
+                    return ChainKey(a) > ChainKey(b);
+                });
+        std::vector<std::size_t> chain = LongestChain(anchors, begin, end);
+        if (chain.size() < kMinChainLength)
+            continue;
+
+        std::vector<unsigned int> q_positions;
+        for (auto i : chain)
+            q_positions.push_back(anchors[i].q_pos);
+        std::sort(q_positions.begin(), q_positions.end());
+
+        Overlap o;
+        o.target_id = anchors[chain.front()].target_id;
+        o.strand = anchors[chain.front()].strand;
+        o.q_begin = q_positions.front();
+        o.q_end = q_positions.back() + kmer_len;
+        o.t_begin = anchors[chain.front()].t_pos;
+        o.t_end = anchors[chain.back()].t_pos + kmer_len;
+        o.matches = 0;
+        o.kmer_len = kmer_len;
+        o.num_anchors = chain.size();
+        for (auto i : chain)
+            o.anchors.emplace_back(anchors[i].q_pos, anchors[i].t_pos);
+        unsigned int covered = 0;
+        for (auto q : q_positions) {
+            o.matches += q + kmer_len - std::max(q, covered);
+            covered = q + kmer_len;
         }
+        overlaps.push_back(o);
     }
-    
-    unsigned int kmer = stoi(new_s);
-    // std::cout << s << " " << new_s << " " << kmer << std::endl;
-    return kmer;
+    IVORY_COUNT(kChains, overlaps.size());
+
+    std::sort(overlaps.begin(), overlaps.end(),
+            [] (const Overlap& a, const Overlap& b) {
+                return a.matches > b.matches;
+            });
+    return overlaps;
 }
 
-unsigned int KmerHashReverse(std::string s) {
-    std::string new_s = "";
-    for (int i = s.size() - 1; i >= 0; i--) {
-        char c = s[i];
-        switch (c) {
+}  // namespace
+
+std::string ReverseComplement(const char* sequence, unsigned int sequence_len) {
+    std::string rc(sequence_len, 'N');
+    for (unsigned int i = 0; i < sequence_len; i++) {
+        switch (sequence[sequence_len - 1 - i]) {
             case 'c':
             case 'C':
-                new_s += "3";
+                rc[i] = 'G';
                 break;
             case 'a':
             case 'A':
-                new_s += "2";
-                break;
-            case 'g':
-            case 'G':
-                new_s += "1";
+                rc[i] = 'T';
                 break;
             case 't':
             case 'T':
-                new_s += "0";
+                rc[i] = 'A';
+                break;
+            case 'g':
+            case 'G':
+                rc[i] = 'C';
                 break;
         }
     }
-    unsigned int kmer = stoi(new_s);
-    // std::cout << ReverseComplement(s) << " " << new_s << " " << kmer << std::endl;
-    return kmer;
+    return rc;
+}
+
+std::string ReverseComplement(const std::string& s) {
+    return ReverseComplement(s.data(), s.size());
 }
 
-std::tuple<unsigned int, unsigned int, bool> GetMinKmer(
+std::vector<std::tuple<unsigned int, unsigned int, bool>> Minimize(
         const char* sequence, unsigned int sequence_len,
-        unsigned int kmer_len, unsigned int window_len,
-        unsigned int start) {
-        // Isolate the window
-        // Get all the kmers
-        // Hash them
-        // Get the smallest one
-    std::vector<std::tuple<unsigned int, unsigned int, bool>> v;
-    std::tuple<unsigned int, unsigned int, bool> t;
-    unsigned int minimizer = stoi(std::string(kmer_len, '9'));
-    for (int i = 0; i <= window_len - kmer_len; i++) {
-        std::string kmer = "";
-        for (int j = 0; j < kmer_len; j++) {
-            kmer += sequence[start+i+j];
-        }
-        unsigned int kmer_h = KmerHash(kmer);
-        unsigned int pos = start + i;
-        // bool strand = true;
-        if (kmer_h < minimizer) {
-            t = {kmer_h, pos, true};
-            minimizer = kmer_h;
-        }
-        unsigned int kmer_h_rc = KmerHashReverse(kmer);
-        if (kmer_h_rc < minimizer) {
-            t = {kmer_h_rc, pos, false};
-            minimizer = kmer_h_rc;
-        }
-    }
-    std::cout << std::get<0>(t) << " " << std::get<1>(t) << " " << std::get<2>(t) << std::endl;
-    return t;
+        unsigned int kmer_len,
+        unsigned int window_len) {
+    return Minimize(sequence, sequence_len, nullptr, 0, 0, kmer_len,
+                    window_len);
 }
 
 std::vector<std::tuple<unsigned int, unsigned int, bool>> Minimize(
         const char* sequence, unsigned int sequence_len,
+        const char* quality, unsigned int quality_len, unsigned int min_quality,
         unsigned int kmer_len,
         unsigned int window_len) {
-    // Slide the window over the string
-    // For each window find all the kmers
-    // Find unsigned int hash for each kmer
-    // Take the smallest one for each window
+    if (kmer_len == 0 || kmer_len > 16 || window_len == 0) {
+        throw std::invalid_argument(
+                "[ivory::Minimize] error: invalid k-mer or window length");
+    }
+
+    // Slide the window over the sequence, k-mers are 2-bit encoded and rolled
+    // on both strands, while the deque holds the candidates for the smallest
+    // k-mer of the current window in increasing order
     std::vector<std::tuple<unsigned int, unsigned int, bool>> V;
-    for (int start=0; start <= sequence_len - window_len; start++) {
-        std::tuple<unsigned int, unsigned int, bool> min_kmer = GetMinKmer(sequence, sequence_len,
-                kmer_len, window_len, start);
-        std::cout << "out" << std::endl;
-        V.push_back(min_kmer);
+    std::deque<std::tuple<unsigned int, unsigned int, bool>> window;
+    unsigned long long mask = (1ULL << (2 * kmer_len)) - 1;
+    unsigned int shift = 2 * (kmer_len - 1);
+    unsigned long long kmer = 0, kmer_rc = 0;
+    unsigned int run_len = 0, num_kmers = 0;
+
+    // Quality is compared in place, without decoding a copy of it
+    const unsigned char* q = reinterpret_cast<const unsigned char*>(quality);
+    unsigned int q_threshold = min_quality + 33;
+
+    auto store = [&V] (const std::tuple<unsigned int, unsigned int, bool>& m) {
+        if (V.empty() || std::get<1>(V.back()) != std::get<1>(m) ||
+                std::get<2>(V.back()) != std::get<2>(m))
+            V.push_back(m);
+    };
+
+    for (unsigned int i = 0; i <= sequence_len; i++) {
+        unsigned int c = i < sequence_len ? Encode(sequence[i]) : 4;
+        if (q != nullptr && i < sequence_len &&
+                (i >= quality_len || q[i] < q_threshold)) {
+            IVORY_COUNT(kMaskedBases, 1);
+            c = 4;
+        }
+        if (c > 3) {
+            // Sequences shorter than one window still get a minimizer
+            if (num_kmers > 0 && num_kmers < window_len)
+                store(window.front());
+            window.clear();
+            run_len = num_kmers = 0;
+            kmer = kmer_rc = 0;
+            continue;
+        }
+
+        kmer = ((kmer << 2) | c) & mask;
+        kmer_rc = (kmer_rc >> 2) | (static_cast<unsigned long long>(c ^ 2) << shift);
+        if (++run_len < kmer_len)
+            continue;
+
+        unsigned int pos = i + 1 - kmer_len;
+        std::tuple<unsigned int, unsigned int, bool> t = kmer <= kmer_rc ?
+                std::make_tuple(static_cast<unsigned int>(kmer), pos, true) :
+                std::make_tuple(static_cast<unsigned int>(kmer_rc), pos, false);
+        while (!window.empty() && std::get<0>(window.back()) > std::get<0>(t))
+            window.pop_back();
+        window.push_back(t);
+        while (std::get<1>(window.front()) + window_len <= pos)
+            window.pop_front();
+
+        if (++num_kmers >= window_len)
+            store(window.front());
     }
-    
-    
-    // std::tuple<unsigned int, unsigned int, bool> t = {1 ,1, 1};
-    // V.push_back(t);
-    return V;
 
+    return V;
 }
 
 void Minimize(
         std::vector<const char*> sequence, std::vector<unsigned int> sequence_len,
         unsigned int kmer_len,
         unsigned int window_len,
-        std::map<unsigned int, std::vector<std::tuple<unsigned int, bool, unsigned int>>>* lookup) {
-    
-    // std::map<unsigned int, std::vector<std::tuple<unsigned int, bool, unsigned int>>> lookup;
-    std::cout << "ayooo" << std::endl;
+        Lookup* lookup) {
+    Minimize(std::move(sequence), std::move(sequence_len), {},
+             kmer_len, window_len, lookup);
+}
 
-    for (int i = 0; i < sequence.size(); i++) {
-        std::vector<std::tuple<unsigned int, unsigned int, bool>> minimizers = 
+void Minimize(
+        std::vector<const char*> sequence, std::vector<unsigned int> sequence_len,
+        const std::vector<std::vector<std::pair<unsigned int, unsigned int>>>& masks,  // NOLINT
+        unsigned int kmer_len,
+        unsigned int window_len,
+        Lookup* lookup) {
+    for (unsigned int i = 0; i < sequence.size(); i++) {
+        std::vector<std::tuple<unsigned int, unsigned int, bool>> minimizers =
                 Minimize(sequence[i], sequence_len[i], kmer_len, window_len);
-        for (auto & m: minimizers) {
-            (*lookup)[std::get<0>(m)].push_back({i, std::get<2>(m), std::get<1>(m)});
+        // Minimizers and masked intervals are both in increasing order
+        static const std::vector<std::pair<unsigned int, unsigned int>> none;
+        const auto& mask = i < masks.size() ? masks[i] : none;
+        std::size_t j = 0;
+        for (auto& m : minimizers) {
+            unsigned int pos = std::get<1>(m);
+            while (j < mask.size() && mask[j].second <= pos)
+                j++;
+            if (j < mask.size() && mask[j].first < pos + kmer_len)
+                continue;
+            (*lookup)[std::get<0>(m)].emplace_back(
+                    i, std::get<2>(m), std::get<1>(m));
         }
     }
-    for (auto it = lookup->begin(); it != lookup->end(); it++) {
-        std::cout << it->first << std::endl;
-        for (auto itt = it->second.begin(); itt != it->second.end(); itt++) {
-            std::cout << std::get<0>(*itt) << " " << std::get<1>(*itt) << " " << std::get<2>(*itt) << std::endl;
-        }
-    }
-    return;
-
 }
 
-void Filter(double frequency) {
-    return;
+void Filter(double frequency, Lookup* lookup) {
+    if (lookup->empty() || frequency <= 0)
+        return;
+
+    std::vector<std::size_t> occurrences;
+    occurrences.reserve(lookup->size());
+    for (auto& it : *lookup)
+        occurrences.push_back(it.second.size());
+
+    std::size_t n = frequency * occurrences.size();
+    if (n == 0)
+        return;
+
+    std::size_t threshold = 0;
+    if (n < occurrences.size()) {
+        std::nth_element(occurrences.begin(), occurrences.begin() + n,
+                         occurrences.end(), std::greater<std::size_t>());
+        threshold = occurrences[n];
+    }
+
+    for (auto it = lookup->begin(); it != lookup->end();) {
+        if (it->second.size() > threshold)
+            it = lookup->erase(it);
+        else
+            ++it;
+    }
 }
 
-// struct Overlap {int i = 0;};
+std::vector<Overlap> Map(
+        const char* sequence, unsigned int sequence_len,
+        const Lookup& lookup,
+        unsigned int kmer_len,
+        unsigned int window_len,
+        unsigned int target_limit,
+        const char* quality,
+        unsigned int quality_len,
+        unsigned int min_quality,
+        const RescueIndex* rescue) {
+    std::vector<Overlap> overlaps = SeedAndChain(
+            sequence, sequence_len, lookup, kmer_len, window_len,
+            target_limit, quality, quality_len, min_quality);
+    if (rescue == nullptr || (!overlaps.empty() &&
+            QuerySpan(overlaps.front()) >= sequence_len * kRescueSpan)) {
+        return overlaps;
+    }
 
-// std::vector<Overlap> Map(const char* sequence, unsigned int sequence_len) {
-//     std::vector<Overlap> V;
-//     return V;
-// }
+    IVORY_COUNT(kRescuedReads, 1);
+    std::vector<Overlap> rescued = SeedAndChain(
+            sequence, sequence_len, rescue->lookup, rescue->kmer_len,
+            rescue->window_len, target_limit, quality, quality_len,
+            min_quality);
+    if (!rescued.empty() && (overlaps.empty() ||
+            QuerySpan(rescued.front()) > QuerySpan(overlaps.front()))) {
+        overlaps.swap(rescued);
+    }
+    return overlaps;
+}
 
 }  // namespace ivory
-
-// int main() {
-//     return 0;
-// }
\ No newline at end of file
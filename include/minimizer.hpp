@@ -1,34 +1,101 @@
 // Copyright (c) 2021 Lovro Vrcek
 
 #ifndef INCLUDE_MINIMIZER_HPP_
-#define INCLUDE_MINIMZER_HPP_
+#define INCLUDE_MINIMIZER_HPP_
 
+#include <climits>
 #include <iostream>
 #include <vector>
 #include <string>
 #include <tuple>
+#include <unordered_map>
+#include <utility>
 
 namespace ivory {
 
-std::tuple<unsigned int, unsigned int, bool> GetMinKmer();
+// Minimizer lookup table, maps a minimizer to the list of its origins
+// (sequence id, strand, position)
+typedef std::unordered_map<unsigned int,
+        std::vector<std::tuple<unsigned int, bool, unsigned int>>> Lookup;
 
+struct Overlap {
+    unsigned int target_id;
+    bool strand;  // true if the query and the target are on the same strand
+    unsigned int q_begin, q_end;
+    unsigned int t_begin, t_end;
+    unsigned int matches;  // number of query bases covered by the chain
+    unsigned int kmer_len;  // length of the k-mers of the anchors
+    unsigned int num_anchors;
+    // Chain of k-mer matches as (query, target) positions, in increasing
+    // target order
+    std::vector<std::pair<unsigned int, unsigned int>> anchors;
+};
+
+// Denser minimizer index of the same sequences, e.g. with a smaller k-mer
+// and window size, only queried for reads the main index maps poorly
+struct RescueIndex {
+    Lookup lookup;
+    unsigned int kmer_len = 0;
+    unsigned int window_len = 0;
+};
+
+std::string ReverseComplement(const char* sequence, unsigned int sequence_len);
+
+std::string ReverseComplement(const std::string& s);
+
+// Returns (minimizer, position, strand) for each window of window_len
+// consecutive k-mers, kmer_len has to be in [1, 16]
+std::vector<std::tuple<unsigned int, unsigned int, bool>> Minimize(
+    const char* sequence, unsigned int sequence_len,
+    unsigned int kmer_len,
+    unsigned int window_len);
+
+// Same as above, but bases with Phred+33 encoded quality below min_quality
+// break k-mers like N does, as do bases past quality_len, the quality is
+// ignored if nullptr
 std::vector<std::tuple<unsigned int, unsigned int, bool>> Minimize(
     const char* sequence, unsigned int sequence_len,
+    const char* quality, unsigned int quality_len, unsigned int min_quality,
     unsigned int kmer_len,
     unsigned int window_len);
 
+// Stores minimizers of all sequences into lookup
 void Minimize(
     std::vector<const char*> sequence, std::vector<unsigned int> sequence_len,
     unsigned int kmer_len,
     unsigned int window_len,
-    std::map<unsigned int, std::vector<std::tuple<unsigned int, bool , unsigned int>>>* lookup);
+    Lookup* lookup);
 
-void Filter(double frequency);
+// Same as above, but skips the minimizers overlapping the masked intervals
+// of each sequence, given as [begin, end) pairs in increasing order
+void Minimize(
+    std::vector<const char*> sequence, std::vector<unsigned int> sequence_len,
+    const std::vector<std::vector<std::pair<unsigned int, unsigned int>>>& masks,  // NOLINT
+    unsigned int kmer_len,
+    unsigned int window_len,
+    Lookup* lookup);
 
-// struct Overlap {int i;};
+// Removes the given fraction of the most frequent minimizers
+void Filter(double frequency, Lookup* lookup);
 
-// std::vector<Overlap> Map(const char* sequence, unsigned int sequence_len);
+// Chains minimizer matches between the query and the sequences in lookup
+// with id lower than target_limit, lookup is only read so it can be shared
+// between threads. Query k-mers covering bases of quality below min_quality,
+// or past quality_len, are not seeded. Reads without chains, or whose best
+// chain spans less than 80% of the query, are seeded again with the rescue
+// index if not null, and its chains are kept if the best one spans more of
+// the query.
+std::vector<Overlap> Map(
+    const char* sequence, unsigned int sequence_len,
+    const Lookup& lookup,
+    unsigned int kmer_len,
+    unsigned int window_len,
+    unsigned int target_limit = UINT_MAX,
+    const char* quality = nullptr,
+    unsigned int quality_len = 0,
+    unsigned int min_quality = 0,
+    const RescueIndex* rescue = nullptr);
 
 }  // namespace ivory
 
-#endif  // INCLUDE_MINIMIZER_HPP_
\ No newline at end of file
+#endif  // INCLUDE_MINIMIZER_HPP_
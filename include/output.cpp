@@ -0,0 +1,197 @@
+// Copyright (c) 2021 Lovro Vrcek
+
+#include "output.hpp"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+namespace ivory {
+
+void OutputBuffer::AppendInteger(long long value) {
+    char digits[20];
+    int n = 0;
+    unsigned long long v = value < 0 ?
+            0ULL - static_cast<unsigned long long>(value) : value;
+    do {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v != 0);
+    if (value < 0)
+        data_.push_back('-');
+    while (n > 0)
+        data_.push_back(digits[--n]);
+}
+
+OutputWriter::OutputWriter(int fd, std::size_t capacity)
+        : fd_(fd),
+          capacity_(capacity) {
+    buffer_.reserve(capacity_);
+}
+
+OutputWriter::~OutputWriter() {
+    try {
+        Flush();
+    } catch (const std::runtime_error&) {
+    }
+}
+
+void OutputWriter::Write(const char* data, std::size_t len) {
+    if (buffer_.size() + len > capacity_)
+        Flush();
+    if (len >= capacity_)
+        WriteAll(data, len);
+    else
+        buffer_.append(data, len);
+}
+
+void OutputWriter::Flush() {
+    WriteAll(buffer_.data(), buffer_.size());
+    buffer_.clear();
+}
+
+void OutputWriter::WriteAll(const char* data, std::size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd_, data, len);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            throw std::runtime_error(
+                    std::string("[ivory::OutputWriter] error: ") +
+                    strerror(errno));
+        }
+        data += written;
+        len -= written;
+    }
+}
+
+void AppendPaf(
+        const SequenceView& query,
+        const SequenceView& target,
+        const Overlap& overlap,
+        const std::string& cigar,
+        OutputBuffer* buffer) {
+    buffer->Append(query.name, query.name_len);
+    buffer->Append('\t');
+    buffer->AppendInteger(query.data_len);
+    buffer->Append('\t');
+    buffer->AppendInteger(overlap.q_begin);
+    buffer->Append('\t');
+    buffer->AppendInteger(overlap.q_end);
+    buffer->Append('\t');
+    buffer->Append(overlap.strand ? '+' : '-');
+    buffer->Append('\t');
+    buffer->Append(target.name, target.name_len);
+    buffer->Append('\t');
+    buffer->AppendInteger(target.data_len);
+    buffer->Append('\t');
+    buffer->AppendInteger(overlap.t_begin);
+    buffer->Append('\t');
+    buffer->AppendInteger(overlap.t_end);
+    buffer->Append('\t');
+    buffer->AppendInteger(overlap.matches);
+    buffer->Append('\t');
+    buffer->AppendInteger(std::max(overlap.q_end - overlap.q_begin,
+                                   overlap.t_end - overlap.t_begin));
+    buffer->Append("\t255", 4);
+    if (!cigar.empty()) {
+        buffer->Append("\tcg:Z:", 6);
+        buffer->Append(cigar);
+    }
+    buffer->Append('\n');
+}
+
+void AppendSamHeader(
+        const std::vector<SequenceView>& targets,
+        const std::string& version,
+        OutputBuffer* buffer) {
+    buffer->Append("@HD\tVN:1.6\tSO:unsorted\n");
+    for (auto& it : targets) {
+        buffer->Append("@SQ\tSN:", 7);
+        buffer->Append(it.name, it.name_len);
+        buffer->Append("\tLN:", 4);
+        buffer->AppendInteger(it.data_len);
+        buffer->Append('\n');
+    }
+    buffer->Append("@PG\tID:ivory_mapper\tPN:ivory_mapper\tVN:");
+    buffer->Append(version);
+    buffer->Append('\n');
+}
+
+void AppendSam(
+        const SequenceView& query,
+        const SequenceView* target,
+        const Overlap* overlap,
+        const std::string& cigar,
+        bool secondary,
+        OutputBuffer* buffer) {
+    buffer->Append(query.name, query.name_len);
+    buffer->Append('\t');
+    if (overlap == nullptr) {
+        buffer->Append("4\t*\t0\t0\t*\t*\t0\t0\t");
+        buffer->Append(query.data, query.data_len);
+        buffer->Append('\t');
+        if (query.quality_len == 0)
+            buffer->Append('*');
+        else
+            buffer->Append(query.quality, query.quality_len);
+        buffer->Append('\n');
+        return;
+    }
+
+    buffer->AppendInteger((overlap->strand ? 0 : 16) | (secondary ? 256 : 0));
+    buffer->Append('\t');
+    buffer->Append(target->name, target->name_len);
+    buffer->Append('\t');
+    buffer->AppendInteger(overlap->t_begin + 1);
+    buffer->Append("\t255\t", 5);
+
+    if (cigar.empty()) {
+        buffer->Append('*');
+    } else {
+        unsigned int query_len = query.data_len;
+        unsigned int clip_begin = overlap->strand ?
+                overlap->q_begin : query_len - overlap->q_end;
+        unsigned int clip_end = overlap->strand ?
+                query_len - overlap->q_end : overlap->q_begin;
+        if (clip_begin > 0) {
+            buffer->AppendInteger(clip_begin);
+            buffer->Append('S');
+        }
+        buffer->Append(cigar);
+        if (clip_end > 0) {
+            buffer->AppendInteger(clip_end);
+            buffer->Append('S');
+        }
+    }
+    buffer->Append("\t*\t0\t0\t", 7);
+
+    if (secondary) {
+        buffer->Append("*\t*\n", 4);
+        return;
+    }
+    if (overlap->strand) {
+        buffer->Append(query.data, query.data_len);
+    } else {
+        buffer->Append(ReverseComplement(query.data, query.data_len));
+    }
+    buffer->Append('\t');
+    if (query.quality_len == 0) {
+        buffer->Append('*');
+    } else if (overlap->strand) {
+        buffer->Append(query.quality, query.quality_len);
+    } else {
+        for (std::uint32_t i = query.quality_len; i > 0; i--)
+            buffer->Append(query.quality[i - 1]);
+    }
+    buffer->Append('\n');
+}
+
+}  // namespace ivory
@@ -0,0 +1,104 @@
+// Copyright (c) 2021 Lovro Vrcek
+
+#ifndef INCLUDE_OUTPUT_HPP_
+#define INCLUDE_OUTPUT_HPP_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "minimizer.hpp"
+#include "reader.hpp"
+
+namespace ivory {
+
+// Growable byte buffer with integer formatting that avoids temporary strings
+class OutputBuffer {
+ public:
+    void Append(const char* data, std::size_t len) {
+        data_.append(data, len);
+    }
+
+    void Append(const std::string& s) {
+        data_.append(s);
+    }
+
+    void Append(char c) {
+        data_.push_back(c);
+    }
+
+    void AppendInteger(long long value);
+
+    const std::string& data() const {
+        return data_;
+    }
+
+    std::size_t size() const {
+        return data_.size();
+    }
+
+    void Clear() {
+        data_.clear();
+    }
+
+ private:
+    std::string data_;
+};
+
+// Collects output and hands it to a file descriptor in large write(2)
+// calls, throws std::runtime_error if writing fails
+class OutputWriter {
+ public:
+    explicit OutputWriter(int fd, std::size_t capacity = 1 << 22);
+
+    OutputWriter(const OutputWriter&) = delete;
+    OutputWriter& operator=(const OutputWriter&) = delete;
+
+    ~OutputWriter();
+
+    void Write(const char* data, std::size_t len);
+
+    void Write(const OutputBuffer& buffer) {
+        Write(buffer.data().data(), buffer.size());
+    }
+
+    void Flush();
+
+ private:
+    void WriteAll(const char* data, std::size_t len);
+
+    int fd_;
+    std::size_t capacity_;
+    std::string buffer_;
+};
+
+// Appends a PAF line, cigar is stored in the cg:Z: tag if it is not empty,
+// in the SAM convention where I consumes the query and D the target
+void AppendPaf(
+        const SequenceView& query,
+        const SequenceView& target,
+        const Overlap& overlap,
+        const std::string& cigar,
+        OutputBuffer* buffer);
+
+// Appends the SAM header for the given targets
+void AppendSamHeader(
+        const std::vector<SequenceView>& targets,
+        const std::string& version,
+        OutputBuffer* buffer);
+
+// Appends a SAM line of the overlap, or of an unmapped query if overlap is
+// nullptr (target is ignored then). The cigar has to span the whole overlap
+// in the SAM convention, the unaligned query ends are added as soft clips.
+// Secondary lines omit the sequence and qualities.
+void AppendSam(
+        const SequenceView& query,
+        const SequenceView* target,
+        const Overlap* overlap,
+        const std::string& cigar,
+        bool secondary,
+        OutputBuffer* buffer);
+
+}  // namespace ivory
+
+#endif  // INCLUDE_OUTPUT_HPP_
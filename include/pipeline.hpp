@@ -0,0 +1,110 @@
+// Copyright (c) 2021 Lovro Vrcek
+
+#ifndef INCLUDE_PIPELINE_HPP_
+#define INCLUDE_PIPELINE_HPP_
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+namespace ivory {
+
+// Blocking queue connecting two pipeline stages, Push blocks while the
+// channel holds capacity items
+template<typename T>
+class Channel {
+ public:
+    explicit Channel(std::size_t capacity = SIZE_MAX)
+            : capacity_(capacity),
+              closed_(false) {}
+
+    Channel(const Channel&) = delete;
+    Channel& operator=(const Channel&) = delete;
+
+    // Returns false and drops the item if the channel is closed
+    bool Push(T item) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            not_full_.wait(lock, [this] () {
+                return closed_ || items_.size() < capacity_;
+            });
+            if (closed_)
+                return false;
+            items_.emplace_back(std::move(item));
+        }
+        not_empty_.notify_one();
+        return true;
+    }
+
+    // Returns false once the channel is closed and drained
+    bool Pop(T* item) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            not_empty_.wait(lock, [this] () {
+                return closed_ || !items_.empty();
+            });
+            if (items_.empty())
+                return false;
+            *item = std::move(items_.front());
+            items_.pop_front();
+        }
+        not_full_.notify_one();
+        return true;
+    }
+
+    void Close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+        }
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+
+ private:
+    std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+    std::deque<T> items_;
+    std::size_t capacity_;
+    bool closed_;
+};
+
+// Limits the number of bytes held by all stages of a pipeline at once,
+// a request larger than the limit is let through when nothing else is held
+class MemoryBudget {
+ public:
+    explicit MemoryBudget(std::uint64_t limit) : limit_(limit), used_(0) {}
+
+    MemoryBudget(const MemoryBudget&) = delete;
+    MemoryBudget& operator=(const MemoryBudget&) = delete;
+
+    void Acquire(std::uint64_t bytes) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        condition_.wait(lock, [this, bytes] () {
+            return used_ == 0 || used_ + bytes <= limit_;
+        });
+        used_ += bytes;
+    }
+
+    void Release(std::uint64_t bytes) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            used_ -= bytes;
+        }
+        condition_.notify_all();
+    }
+
+ private:
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    std::uint64_t limit_;
+    std::uint64_t used_;
+};
+
+}  // namespace ivory
+
+#endif  // INCLUDE_PIPELINE_HPP_
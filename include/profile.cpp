@@ -0,0 +1,179 @@
+// Copyright (c) 2021 Lovro Vrcek
+
+#include "profile.hpp"
+
+#include <sys/resource.h>
+#include <time.h>
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+namespace ivory {
+
+const char* const kProfileCounterNames[kNumProfileCounters] = {
+    "parsed_sequences",
+    "parsed_bases",
+    "masked_bases",
+    "minimizers",
+    "index_lookups",
+    "filtered_lookups",
+    "anchors",
+    "chains",
+    "rescued_reads",
+    "alignments",
+    "cells",
+    "output_bytes",
+};
+
+const char* const kProfileStageNames[kNumProfileStages] = {
+    "parse",
+    "minimize",
+    "lookup",
+    "chain",
+    "align",
+    "output",
+};
+
+namespace {
+
+// Latencies are binned by their highest set bit and the three bits below it
+const unsigned int kSubBuckets = 8;
+const unsigned int kLatencyBuckets = 64 * kSubBuckets;
+const std::size_t kNumSlowestReads = 10;
+
+inline unsigned int LatencyBucket(std::uint64_t ns) {
+    if (ns < kSubBuckets)
+        return ns;
+    unsigned int log = 63 - __builtin_clzll(ns);
+    return log * kSubBuckets + ((ns >> (log - 3)) & (kSubBuckets - 1));
+}
+
+// Largest latency which falls into the bucket
+inline std::uint64_t BucketUpperBound(unsigned int bucket) {
+    if (bucket < kSubBuckets)
+        return bucket;
+    unsigned int log = bucket / kSubBuckets;
+    std::uint64_t sub = bucket % kSubBuckets;
+    return ((kSubBuckets + sub + 1) << (log - 3)) - 1;
+}
+
+typedef std::pair<std::uint64_t, std::string> SlowRead;
+
+struct ThreadProfile {
+    std::uint64_t counters[kNumProfileCounters] = {};
+    std::uint64_t wall_ns[kNumProfileStages] = {};
+    std::uint64_t cpu_ns[kNumProfileStages] = {};
+    std::uint64_t latency[kLatencyBuckets] = {};
+    std::uint64_t max_latency_ns = 0;
+    std::vector<SlowRead> slowest;  // min heap
+};
+
+std::mutex registry_mutex;
+// Profiles outlive their threads, so they are never freed
+std::vector<ThreadProfile*>* registry = new std::vector<ThreadProfile*>();
+
+ThreadProfile& LocalProfile() {
+    static thread_local ThreadProfile* profile = nullptr;
+    if (profile == nullptr) {
+        profile = new ThreadProfile();
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        registry->push_back(profile);
+    }
+    return *profile;
+}
+
+}  // namespace
+
+void ProfileAdd(ProfileCounter counter, std::uint64_t n) {
+    LocalProfile().counters[counter] += n;
+}
+
+void ProfileStageTime(ProfileStage stage, std::uint64_t wall_ns,
+                      std::uint64_t cpu_ns) {
+    ThreadProfile& profile = LocalProfile();
+    profile.wall_ns[stage] += wall_ns;
+    profile.cpu_ns[stage] += cpu_ns;
+}
+
+void ProfileReadLatency(const char* name, std::uint32_t name_len,
+                        std::uint64_t latency_ns) {
+    ThreadProfile& profile = LocalProfile();
+    profile.latency[LatencyBucket(latency_ns)]++;
+    profile.max_latency_ns = std::max(profile.max_latency_ns, latency_ns);
+
+    std::vector<SlowRead>& slowest = profile.slowest;
+    if (slowest.size() == kNumSlowestReads) {
+        if (latency_ns <= slowest.front().first)
+            return;
+        std::pop_heap(slowest.begin(), slowest.end(),
+                      std::greater<SlowRead>());
+        slowest.pop_back();
+    }
+    slowest.emplace_back(latency_ns, std::string(name, name_len));
+    std::push_heap(slowest.begin(), slowest.end(), std::greater<SlowRead>());
+}
+
+std::uint64_t ThreadCpuTime() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+std::uint64_t ProfileReport::LatencyPercentile(double fraction) const {
+    std::uint64_t threshold = fraction * num_reads;
+    std::uint64_t sum = 0;
+    for (unsigned int i = 0; i < latency_histogram.size(); i++) {
+        sum += latency_histogram[i];
+        if (sum > 0 && sum >= threshold)
+            return std::min(BucketUpperBound(i), max_latency_ns);
+    }
+    return 0;
+}
+
+ProfileReport CollectProfile() {
+    ProfileReport report;
+    std::fill(report.counters, report.counters + kNumProfileCounters, 0);
+    std::fill(report.wall_ns, report.wall_ns + kNumProfileStages, 0);
+    std::fill(report.cpu_ns, report.cpu_ns + kNumProfileStages, 0);
+    report.num_reads = 0;
+    report.max_latency_ns = 0;
+    report.latency_histogram.assign(kLatencyBuckets, 0);
+
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    for (auto profile : *registry) {
+        for (int i = 0; i < kNumProfileCounters; i++)
+            report.counters[i] += profile->counters[i];
+        for (int i = 0; i < kNumProfileStages; i++) {
+            report.wall_ns[i] += profile->wall_ns[i];
+            report.cpu_ns[i] += profile->cpu_ns[i];
+        }
+        for (unsigned int i = 0; i < kLatencyBuckets; i++) {
+            report.latency_histogram[i] += profile->latency[i];
+            report.num_reads += profile->latency[i];
+        }
+        report.max_latency_ns = std::max(report.max_latency_ns,
+                                         profile->max_latency_ns);
+        report.slowest_reads.insert(report.slowest_reads.end(),
+                                    profile->slowest.begin(),
+                                    profile->slowest.end());
+    }
+    std::sort(report.slowest_reads.begin(), report.slowest_reads.end(),
+              std::greater<SlowRead>());
+    if (report.slowest_reads.size() > kNumSlowestReads)
+        report.slowest_reads.resize(kNumSlowestReads);
+    return report;
+}
+
+std::uint64_t PeakRss() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+}  // namespace ivory
@@ -0,0 +1,139 @@
+// Copyright (c) 2021 Lovro Vrcek
+
+#ifndef INCLUDE_PROFILE_HPP_
+#define INCLUDE_PROFILE_HPP_
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace ivory {
+
+// Events counted on the hot paths
+enum ProfileCounter {
+    kParsedSequences,
+    kParsedBases,
+    kMaskedBases,  // low quality query bases excluded from seeding
+    kMinimizers,
+    kIndexLookups,
+    kFilteredLookups,  // minimizers missing from the (filtered) index
+    kAnchors,
+    kChains,
+    kRescuedReads,  // reads seeded again with the rescue index
+    kAlignments,
+    kCells,  // dynamic programming cells computed
+    kOutputBytes,
+    kNumProfileCounters
+};
+
+enum ProfileStage {
+    kParseStage,
+    kMinimizeStage,
+    kLookupStage,
+    kChainStage,
+    kAlignStage,
+    kOutputStage,
+    kNumProfileStages
+};
+
+extern const char* const kProfileCounterNames[kNumProfileCounters];
+extern const char* const kProfileStageNames[kNumProfileStages];
+
+// Counters and timers are kept per thread without synchronization, and are
+// summed up by CollectProfile once the threads are idle
+void ProfileAdd(ProfileCounter counter, std::uint64_t n);
+
+void ProfileStageTime(ProfileStage stage, std::uint64_t wall_ns,
+                      std::uint64_t cpu_ns);
+
+void ProfileReadLatency(const char* name, std::uint32_t name_len,
+                        std::uint64_t latency_ns);
+
+// CPU time of the calling thread
+std::uint64_t ThreadCpuTime();
+
+// Adds the wall and CPU time of its scope to a stage
+class ScopedTimer {
+ public:
+    explicit ScopedTimer(ProfileStage stage)
+            : stage_(stage),
+              wall_(std::chrono::steady_clock::now()),
+              cpu_(ThreadCpuTime()) {}
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+    ~ScopedTimer() {
+        ProfileStageTime(stage_, std::chrono::duration_cast<std::chrono::nanoseconds>(  // NOLINT
+                std::chrono::steady_clock::now() - wall_).count(),
+                ThreadCpuTime() - cpu_);
+    }
+
+ private:
+    ProfileStage stage_;
+    std::chrono::steady_clock::time_point wall_;
+    std::uint64_t cpu_;
+};
+
+// Records the wall time of its scope as the latency of one read
+class ReadTimer {
+ public:
+    ReadTimer(const char* name, std::uint32_t name_len)
+            : name_(name),
+              name_len_(name_len),
+              begin_(std::chrono::steady_clock::now()) {}
+
+    ReadTimer(const ReadTimer&) = delete;
+    ReadTimer& operator=(const ReadTimer&) = delete;
+
+    ~ReadTimer() {
+        ProfileReadLatency(name_, name_len_, std::chrono::duration_cast<std::chrono::nanoseconds>(  // NOLINT
+                std::chrono::steady_clock::now() - begin_).count());
+    }
+
+ private:
+    const char* name_;
+    std::uint32_t name_len_;
+    std::chrono::steady_clock::time_point begin_;
+};
+
+struct ProfileReport {
+    std::uint64_t counters[kNumProfileCounters];
+    std::uint64_t wall_ns[kNumProfileStages];  // summed over threads
+    std::uint64_t cpu_ns[kNumProfileStages];
+    std::uint64_t num_reads;
+    std::uint64_t max_latency_ns;
+    std::vector<std::uint64_t> latency_histogram;
+    std::vector<std::pair<std::uint64_t, std::string>> slowest_reads;
+
+    // Upper bound of the latency below which the given fraction of reads
+    // finished, accurate to within 1/8 of the value
+    std::uint64_t LatencyPercentile(double fraction) const;
+};
+
+ProfileReport CollectProfile();
+
+// Peak resident set size of the process in kB
+std::uint64_t PeakRss();
+
+}  // namespace ivory
+
+// Instrumentation of the hot paths is compiled in only with IVORY_PROFILE
+#define IVORY_PROFILE_CONCAT_(a, b) a##b
+#define IVORY_PROFILE_CONCAT(a, b) IVORY_PROFILE_CONCAT_(a, b)
+
+#ifdef IVORY_PROFILE
+#define IVORY_COUNT(counter, n) ::ivory::ProfileAdd(::ivory::counter, n)
+#define IVORY_TIME(stage) ::ivory::ScopedTimer \
+        IVORY_PROFILE_CONCAT(ivory_timer_, __LINE__)(::ivory::stage)
+#define IVORY_TIME_READ(name, name_len) ::ivory::ReadTimer \
+        IVORY_PROFILE_CONCAT(ivory_read_timer_, __LINE__)(name, name_len)
+#else
+#define IVORY_COUNT(counter, n) do {} while (0)
+#define IVORY_TIME(stage) do {} while (0)
+#define IVORY_TIME_READ(name, name_len) do {} while (0)
+#endif
+
+#endif  // INCLUDE_PROFILE_HPP_
@@ -0,0 +1,520 @@
+// Copyright (c) 2021 Lovro Vrcek
+
+#include "reader.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <exception>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "pipeline.hpp"
+
+
+namespace ivory {
+
+namespace {
+
+const std::size_t kBlockSize = 1 << 20;
+// Compressed bytes of BGZF blocks inflated by one task
+const std::size_t kBgzfGroupSize = 1 << 20;
+const std::size_t kBgzfHeaderSize = 18;
+// Uncompressed bytes of a BGZF block are limited by the format
+const std::uint32_t kBgzfMaxBlockSize = 1 << 16;
+
+// Gzip header carrying the BGZF extra field with the block size
+bool IsBgzfHeader(const unsigned char* header) {
+    return header[0] == 0x1f && header[1] == 0x8b && header[2] == 8 &&
+           (header[3] & 4) != 0 && header[10] == 6 && header[11] == 0 &&
+           header[12] == 'B' && header[13] == 'C' &&
+           header[14] == 2 && header[15] == 0;
+}
+
+// Returns the number of bytes read, which is less than len only at the end
+// of the file, or -1 on error
+ssize_t ReadFully(int fd, char* data, std::size_t len) {
+    std::size_t total = 0;
+    while (total < len) {
+        ssize_t n = read(fd, data + total, len - total);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        if (n == 0)
+            break;
+        total += n;
+    }
+    return total;
+}
+
+// Inflates consecutive BGZF blocks, each of which is a complete gzip member
+// ending with the size of its uncompressed data
+std::string InflateBgzf(const std::string& group) {
+    std::string data;
+    z_stream stream;
+    for (std::size_t begin = 0, end; begin < group.size(); begin = end) {
+        const unsigned char* block =
+                reinterpret_cast<const unsigned char*>(group.data()) + begin;
+        end = begin + (block[16] | (block[17] << 8)) + 1;
+        std::uint32_t len = block[end - begin - 4] |
+                            (block[end - begin - 3] << 8) |
+                            (block[end - begin - 2] << 16) |
+                            (static_cast<std::uint32_t>(block[end - begin - 1]) << 24);  // NOLINT
+        if (len == 0)
+            continue;
+        if (len > kBgzfMaxBlockSize) {
+            throw std::runtime_error(
+                    "[ivory::SequenceReader] error: corrupted BGZF block");
+        }
+
+        std::size_t size = data.size();
+        data.resize(size + len);
+        stream.zalloc = Z_NULL;
+        stream.zfree = Z_NULL;
+        stream.opaque = Z_NULL;
+        stream.next_in = const_cast<unsigned char*>(block);
+        stream.avail_in = end - begin;
+        stream.next_out = reinterpret_cast<unsigned char*>(&data[size]);
+        stream.avail_out = len;
+        if (inflateInit2(&stream, 15 + 16) != Z_OK) {
+            throw std::runtime_error(
+                    "[ivory::SequenceReader] error: unable to decompress");
+        }
+        int status = inflate(&stream, Z_FINISH);
+        inflateEnd(&stream);
+        if (status != Z_STREAM_END || stream.avail_out != 0) {
+            throw std::runtime_error(
+                    "[ivory::SequenceReader] error: corrupted BGZF block");
+        }
+    }
+    return data;
+}
+
+// Position of the newline ending the line which contains p, or end
+inline const char* LineEnd(const char* p, const char* end) {
+    const char* e = static_cast<const char*>(memchr(p, '\n', end - p));
+    return e == nullptr ? end : e;
+}
+
+inline const char* NextLine(const char* p, const char* end) {
+    p = LineEnd(p, end);
+    return p == end ? end : p + 1;
+}
+
+inline const char* TrimEnd(const char* begin, const char* end) {
+    return end > begin && end[-1] == '\r' ? end - 1 : end;
+}
+
+// Parses the record starting at p, returns the position after it, or
+// nullptr if the record may continue past end and end is not the last byte
+// of input
+const char* ParseRecord(
+        const char* p, const char* end,
+        bool fastq, bool last,
+        SequenceView* view,
+        std::vector<std::unique_ptr<std::string>>* storage) {
+    const char* name_end = LineEnd(p, end);
+    if (name_end == end && !last)
+        return nullptr;
+    const char* name = p + 1;
+    const char* name_trimmed = TrimEnd(name, name_end);
+    const char* name_short = name;
+    while (name_short < name_trimmed && *name_short != ' ' &&
+           *name_short != '\t')
+        name_short++;
+    view->name = name;
+    view->name_len = name_short - name;
+    p = NextLine(p, end);
+
+    if (fastq) {
+        const char* data_end = LineEnd(p, end);
+        const char* quality = NextLine(NextLine(p, end), end);
+        const char* quality_end = LineEnd(quality, end);
+        if (quality_end == end && !last)
+            return nullptr;
+        view->data = p;
+        view->data_len = TrimEnd(p, data_end) - p;
+        view->quality = quality;
+        view->quality_len = TrimEnd(quality, quality_end) - quality;
+        return quality_end == end ? end : quality_end + 1;
+    }
+
+    // Sequence lines last until the next header
+    const char* data = p;
+    unsigned int num_lines = 0;
+    while (p < end && *p != '>') {
+        p = NextLine(p, end);
+        num_lines++;
+    }
+    if (p == end && !last)
+        return nullptr;
+
+    if (num_lines <= 1) {
+        const char* data_end = p > data && p[-1] == '\n' ? p - 1 : p;
+        view->data = data;
+        view->data_len = TrimEnd(data, data_end) - data;
+    } else {
+        std::unique_ptr<std::string> s(new std::string());
+        s->reserve(p - data);
+        for (const char* c = data; c < p; c++) {
+            if (*c != '\n' && *c != '\r')
+                s->push_back(*c);
+        }
+        view->data = s->data();
+        view->data_len = s->size();
+        storage->emplace_back(std::move(s));
+    }
+    view->quality = nullptr;
+    view->quality_len = 0;
+    return p;
+}
+
+template<typename T>
+std::future<T> Failure(const std::string& message) {
+    std::promise<T> result;
+    result.set_exception(std::make_exception_ptr(std::runtime_error(
+            "[ivory::SequenceReader] error: " + message)));
+    return result.get_future();
+}
+
+}  // namespace
+
+// Decompresses the input on a background thread, which stays at most a few
+// blocks ahead of the parser. BGZF input is read as groups of blocks which
+// are inflated in parallel by the workers of the thread pool, or by the
+// background thread if it is nullptr, while other input goes through zlib
+// in order.
+class ReadAhead {
+ public:
+    ReadAhead(int fd, bool bgzf, ThreadPool* thread_pool)
+            : thread_pool_(thread_pool),
+              blocks_(bgzf && thread_pool != nullptr ?
+                      2 * thread_pool->num_threads() : 2) {
+        if (bgzf) {
+            thread_ = std::thread(&ReadAhead::ReadBgzf, this, fd);
+            return;
+        }
+        gzFile file = gzdopen(fd, "r");
+        if (file == nullptr) {
+            close(fd);
+            throw std::runtime_error(
+                    "[ivory::SequenceReader] error: unable to decompress");
+        }
+        gzbuffer(file, 1 << 17);
+        thread_ = std::thread(&ReadAhead::ReadGzip, this, file);
+    }
+
+    ReadAhead(const ReadAhead&) = delete;
+    ReadAhead& operator=(const ReadAhead&) = delete;
+
+    ~ReadAhead() {
+        blocks_.Close();
+        thread_.join();
+    }
+
+    // Returns false at the end of input, throws std::runtime_error if the
+    // input can not be decompressed
+    bool Read(std::string* block) {
+        std::future<std::string> next;
+        if (!blocks_.Pop(&next))
+            return false;
+        *block = next.get();
+        return true;
+    }
+
+ private:
+    void ReadGzip(gzFile file) {
+        while (true) {
+            std::string data(kBlockSize, '\0');
+            int n = gzread(file, &data[0], kBlockSize);
+            if (n < 0) {
+                blocks_.Push(Failure<std::string>("unable to decompress"));
+                break;
+            }
+            if (n == 0)
+                break;
+            data.resize(n);
+            std::promise<std::string> block;
+            block.set_value(std::move(data));
+            if (!blocks_.Push(block.get_future()))
+                break;
+        }
+        gzclose(file);
+        blocks_.Close();
+    }
+
+    void ReadBgzf(int fd) {
+        bool end = false;
+        while (!end) {
+            std::shared_ptr<std::string> group(new std::string());
+            while (group->size() < kBgzfGroupSize) {
+                char header[kBgzfHeaderSize];
+                ssize_t n = ReadFully(fd, header, kBgzfHeaderSize);
+                if (n == 0) {
+                    end = true;
+                    break;
+                }
+                const unsigned char* h =
+                        reinterpret_cast<const unsigned char*>(header);
+                std::size_t block_size = (h[16] | (h[17] << 8)) + 1;
+                if (n != static_cast<ssize_t>(kBgzfHeaderSize) ||
+                        !IsBgzfHeader(h) || block_size < kBgzfHeaderSize + 8) {
+                    group.reset();
+                    break;
+                }
+                std::size_t size = group->size();
+                group->append(header, kBgzfHeaderSize);
+                group->resize(size + block_size);
+                std::size_t rest = block_size - kBgzfHeaderSize;
+                if (ReadFully(fd, &(*group)[size + kBgzfHeaderSize], rest) !=
+                        static_cast<ssize_t>(rest)) {
+                    group.reset();
+                    break;
+                }
+            }
+            if (group == nullptr) {
+                blocks_.Push(Failure<std::string>("corrupted BGZF block"));
+                break;
+            }
+            if (group->empty())
+                continue;
+            std::future<std::string> block;
+            if (thread_pool_ != nullptr) {
+                block = thread_pool_->Submit(
+                        [group] () { return InflateBgzf(*group); });
+            } else {
+                std::promise<std::string> inflated;
+                try {
+                    inflated.set_value(InflateBgzf(*group));
+                } catch (...) {
+                    inflated.set_exception(std::current_exception());
+                }
+                block = inflated.get_future();
+            }
+            if (!blocks_.Push(std::move(block)))
+                break;
+        }
+        close(fd);
+        blocks_.Close();
+    }
+
+    ThreadPool* thread_pool_;
+    Channel<std::future<std::string>> blocks_;
+    std::thread thread_;
+};
+
+SequenceReader::SequenceReader(const std::string& path,
+                               ThreadPool* thread_pool)
+        : fastq_(false),
+          size_(0),
+          offset_(0),
+          eof_(false) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::invalid_argument(
+                "[ivory::SequenceReader] error: unable to open file " + path);
+    }
+    Open(fd, path, thread_pool);
+}
+
+SequenceReader::SequenceReader(int fd, ThreadPool* thread_pool)
+        : fastq_(false),
+          size_(0),
+          offset_(0),
+          eof_(false) {
+    Open(fd, "descriptor " + std::to_string(fd), thread_pool);
+}
+
+void SequenceReader::Open(int fd, const std::string& name,
+                          ThreadPool* thread_pool) {
+    unsigned char header[kBgzfHeaderSize];
+    ssize_t header_len = pread(fd, header, kBgzfHeaderSize, 0);
+    bool compressed = header_len >= 2 &&
+                      header[0] == 0x1f && header[1] == 0x8b;
+    bool bgzf = header_len == static_cast<ssize_t>(kBgzfHeaderSize) &&
+                IsBgzfHeader(header);
+    struct stat st;
+    if (!compressed && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+            st.st_size > 0) {
+        void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED) {
+            std::size_t size = st.st_size;
+            madvise(addr, size, MADV_SEQUENTIAL);
+            mapping_ = std::shared_ptr<const char>(
+                    static_cast<const char*>(addr),
+                    [size] (const char* p) {
+                        munmap(const_cast<char*>(p), size);
+                    });
+            size_ = size;
+        }
+    }
+
+    const char* begin;
+    const char* end;
+    if (mapping_ != nullptr) {
+        close(fd);
+        begin = mapping_.get();
+        end = begin + size_;
+    } else {
+        input_.reset(new ReadAhead(fd, bgzf, thread_pool));
+        eof_ = !input_->Read(&pending_);
+        begin = pending_.data();
+        end = begin + pending_.size();
+    }
+
+    while (begin < end && (*begin == '\n' || *begin == '\r' || *begin == ' '))
+        begin++;
+    if (begin < end && *begin != '>' && *begin != '@') {
+        throw std::invalid_argument(
+                "[ivory::SequenceReader] error: file " + name +
+                " is not in FASTA/FASTQ format");
+    }
+    fastq_ = begin < end && *begin == '@';
+}
+
+SequenceReader::~SequenceReader() {
+}
+
+void SequenceReader::Parse(
+        const char* begin, const char* end, bool last,
+        std::uint64_t bytes, SequenceChunk* chunk,
+        const char** parsed_end) const {
+    const char* p = begin;
+    while (true) {
+        while (p < end && (*p == '\n' || *p == '\r' || *p == ' '))
+            p++;
+        if (p == end || static_cast<std::uint64_t>(p - begin) >= bytes)
+            break;
+        if (*p != (fastq_ ? '@' : '>')) {
+            throw std::runtime_error(
+                    "[ivory::SequenceReader] error: invalid record");
+        }
+        SequenceView view;
+        const char* next = ParseRecord(p, end, fastq_, last, &view,
+                                       &chunk->storage);
+        if (next == nullptr)
+            break;
+        if (fastq_ && view.quality_len != view.data_len) {
+            throw std::runtime_error(
+                    "[ivory::SequenceReader] error: quality length of " +
+                    std::string(view.name, view.name_len) +
+                    " differs from its sequence length");
+        }
+        chunk->sequences.push_back(view);
+        p = next;
+    }
+    *parsed_end = p;
+}
+
+SequenceChunk SequenceReader::Parse(std::uint64_t bytes) {
+    SequenceChunk chunk;
+    const char* parsed_end;
+
+    if (mapping_ != nullptr) {
+        chunk.mapping = mapping_;
+        Parse(mapping_.get() + offset_, mapping_.get() + size_, true, bytes,
+              &chunk, &parsed_end);
+        offset_ = parsed_end - mapping_.get();
+        return chunk;
+    }
+
+    // Records cut off at the end of the buffer are carried over to the next
+    // chunk, the buffer is read further if not even one record fits in it
+    std::unique_ptr<std::string> buffer(new std::string());
+    buffer->swap(pending_);
+    std::uint64_t target = bytes;
+    std::string block;
+    while (true) {
+        while (!eof_ && buffer->size() < target) {
+            if (!input_->Read(&block))
+                eof_ = true;
+            else if (buffer->empty())
+                buffer->swap(block);
+            else
+                buffer->append(block);
+        }
+        const char* end = buffer->data() + buffer->size();
+        Parse(buffer->data(), end, eof_, bytes, &chunk, &parsed_end);
+        if (!chunk.sequences.empty() || eof_) {
+            pending_.assign(parsed_end, end);
+            break;
+        }
+        target = buffer->size() + 1;
+    }
+    chunk.storage.emplace_back(std::move(buffer));
+    return chunk;
+}
+
+const char* SequenceReader::NextRecord(const char* p, const char* end) const {
+    if (p[-1] != '\n')
+        p = NextLine(p, end);
+    for (; p < end; p = NextLine(p, end)) {
+        if (!fastq_ && *p == '>')
+            return p;
+        // A quality line may start with '@' as well, but it is never
+        // followed by a '+' line two lines below
+        if (fastq_ && *p == '@') {
+            const char* plus = NextLine(NextLine(p, end), end);
+            if (plus < end && *plus == '+')
+                return p;
+        }
+    }
+    return end;
+}
+
+SequenceChunk SequenceReader::ParseAll(ThreadPool* thread_pool) {
+    if (mapping_ == nullptr || thread_pool == nullptr ||
+            thread_pool->num_threads() == 1) {
+        return Parse(-1);
+    }
+
+    const char* begin = mapping_.get() + offset_;
+    const char* end = mapping_.get() + size_;
+    unsigned int n = thread_pool->num_threads();
+    std::vector<const char*> bounds(1, begin);
+    for (unsigned int i = 1; i < n; i++) {
+        const char* p = begin + (end - begin) * i / n;
+        bounds.push_back(p > bounds.back() ? NextRecord(p, end) : bounds.back());  // NOLINT
+    }
+    bounds.push_back(end);
+
+    std::vector<SequenceChunk> parts(n);
+    std::vector<std::exception_ptr> errors(n);
+    thread_pool->ParallelFor(n, [&] (std::size_t i, unsigned int) {
+        try {
+            const char* parsed_end;
+            Parse(bounds[i], bounds[i + 1], true, -1, &parts[i], &parsed_end);
+        } catch (...) {
+            errors[i] = std::current_exception();
+        }
+    });
+    for (auto& it : errors) {
+        if (it != nullptr)
+            std::rethrow_exception(it);
+    }
+
+    SequenceChunk chunk;
+    chunk.mapping = mapping_;
+    for (auto& it : parts) {
+        chunk.sequences.insert(chunk.sequences.end(),
+                               it.sequences.begin(), it.sequences.end());
+        for (auto& s : it.storage)
+            chunk.storage.emplace_back(std::move(s));
+    }
+    offset_ = size_;
+    return chunk;
+}
+
+}  // namespace ivory
@@ -0,0 +1,95 @@
+// Copyright (c) 2021 Lovro Vrcek
+
+#ifndef INCLUDE_READER_HPP_
+#define INCLUDE_READER_HPP_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "thread_pool.hpp"
+
+namespace ivory {
+
+// Record of a FASTA/FASTQ file, quality is nullptr for FASTA records
+struct SequenceView {
+    const char* name;
+    std::uint32_t name_len;
+    const char* data;
+    std::uint32_t data_len;
+    const char* quality;
+    std::uint32_t quality_len;
+};
+
+// Records parsed at once. Views point into the memory mapped file, which
+// the chunk keeps mapped, or into storage owned by the chunk for compressed
+// input and for FASTA records spanning multiple lines.
+struct SequenceChunk {
+    std::vector<SequenceView> sequences;
+    std::shared_ptr<const char> mapping;
+    std::vector<std::unique_ptr<std::string>> storage;
+};
+
+class ReadAhead;
+
+// FASTA/FASTQ reader, the format is detected from the first record. Regular
+// uncompressed files are memory mapped and parsed without copying, other
+// input (e.g. gzip) is decompressed ahead of the parser on a background
+// thread, BGZF blocks in parallel by the workers of thread_pool if it is not
+// nullptr. The pool is shared with the caller, so Parse must not be called
+// from its workers. FASTQ records have to span four lines, names are cut at
+// the first whitespace.
+class SequenceReader {
+ public:
+    // Throws std::invalid_argument if the file can not be opened or is not
+    // in FASTA/FASTQ format
+    explicit SequenceReader(const std::string& path,
+                            ThreadPool* thread_pool = nullptr);
+
+    // Reads from an open descriptor, e.g. a pipe or socket, which the reader
+    // takes over and closes once done with it
+    explicit SequenceReader(int fd, ThreadPool* thread_pool = nullptr);
+
+    SequenceReader(const SequenceReader&) = delete;
+    SequenceReader& operator=(const SequenceReader&) = delete;
+
+    ~SequenceReader();
+
+    bool is_fastq() const {
+        return fastq_;
+    }
+
+    bool is_mapped() const {
+        return mapping_ != nullptr;
+    }
+
+    // Returns the records of at least the next bytes of input, an empty chunk
+    // marks the end of the file. Throws std::runtime_error on invalid input.
+    SequenceChunk Parse(std::uint64_t bytes);
+
+    // Parses the rest of the file, a memory mapped file is split at record
+    // boundaries and parsed by all workers of the thread pool
+    SequenceChunk ParseAll(ThreadPool* thread_pool);
+
+ private:
+    void Open(int fd, const std::string& name, ThreadPool* thread_pool);
+
+    void Parse(const char* begin, const char* end, bool last,
+               std::uint64_t bytes, SequenceChunk* chunk,
+               const char** parsed_end) const;
+
+    const char* NextRecord(const char* p, const char* end) const;
+
+    bool fastq_;
+    std::shared_ptr<const char> mapping_;
+    std::uint64_t size_;
+    std::uint64_t offset_;
+    std::unique_ptr<ReadAhead> input_;
+    std::string pending_;
+    bool eof_;
+};
+
+}  // namespace ivory
+
+#endif  // INCLUDE_READER_HPP_
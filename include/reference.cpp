@@ -0,0 +1,153 @@
+// Copyright (c) 2021 Lovro Vrcek
+
+#include "reference.hpp"
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+namespace ivory {
+
+namespace {
+
+// Same codes as the minimizers, CAGT -> 0123
+const char kDecode[4] = {'C', 'A', 'G', 'T'};
+
+inline std::uint64_t Encode(char c) {
+    switch (c) {
+        case 'a':
+        case 'A':
+            return 1;
+        case 'g':
+        case 'G':
+            return 2;
+        case 't':
+        case 'T':
+            return 3;
+        default:
+            return 0;
+    }
+}
+
+inline bool IsBase(char c) {
+    switch (c) {
+        case 'c': case 'C': case 'a': case 'A':
+        case 'g': case 'G': case 't': case 'T':
+            return true;
+        default:
+            return false;
+    }
+}
+
+inline char Complement(char c) {
+    switch (c) {
+        case 'C': return 'G';
+        case 'A': return 'T';
+        case 'G': return 'C';
+        case 'T': return 'A';
+        case 'c': return 'g';
+        case 'a': return 't';
+        case 'g': return 'c';
+        case 't': return 'a';
+        default: return c;
+    }
+}
+
+// Extends the last run if it ends at pos, otherwise starts a new one
+inline void AddToRuns(std::uint32_t pos,
+                      std::vector<std::pair<std::uint32_t, std::uint32_t>>* runs,
+                      std::size_t runs_begin) {
+    if (runs->size() > runs_begin && runs->back().second == pos)
+        runs->back().second++;
+    else
+        runs->emplace_back(pos, pos + 1);
+}
+
+}  // namespace
+
+void ReferenceStore::Add(const SequenceView& sequence) {
+    Sequence s;
+    s.offset = num_bases_;
+    s.n_begin = n_runs_.size();
+    s.lower_begin = lower_runs_.size();
+
+    bases_.resize((num_bases_ + sequence.data_len + 31) / 32, 0);
+    for (std::uint32_t i = 0; i < sequence.data_len; i++) {
+        char c = sequence.data[i];
+        std::uint64_t pos = num_bases_ + i;
+        bases_[pos >> 5] |= Encode(c) << (2 * (pos & 31));
+        if (!IsBase(c))
+            AddToRuns(i, &n_runs_, s.n_begin);
+        if (c >= 'a' && c <= 'z')
+            AddToRuns(i, &lower_runs_, s.lower_begin);
+    }
+    num_bases_ += sequence.data_len;
+
+    s.n_end = n_runs_.size();
+    s.lower_end = lower_runs_.size();
+    sequences_.push_back(s);
+
+    names_.emplace_back(sequence.name, sequence.name_len);
+    SequenceView view = {names_.back().data(), sequence.name_len,
+                         nullptr, sequence.data_len, nullptr, 0};
+    views_.push_back(view);
+}
+
+void ReferenceStore::ApplyRuns(
+        const Runs& runs, std::size_t runs_begin, std::size_t runs_end,
+        std::uint32_t begin, std::uint32_t end, bool lower, char* data) {
+    auto it = std::upper_bound(runs.begin() + runs_begin,
+                               runs.begin() + runs_end, begin,
+            [] (std::uint32_t pos, const std::pair<std::uint32_t, std::uint32_t>& run) {  // NOLINT
+                return pos < run.second;
+            });
+    for (; it != runs.begin() + runs_end && it->first < end; ++it) {
+        std::uint32_t run_end = std::min(it->second, end);
+        for (std::uint32_t i = std::max(it->first, begin); i < run_end; i++) {
+            if (lower)
+                data[i - begin] += 'a' - 'A';
+            else
+                data[i - begin] = 'N';
+        }
+    }
+}
+
+void ReferenceStore::Extract(
+        std::size_t id, std::uint32_t begin, std::uint32_t end,
+        bool strand, std::string* buffer) const {
+    const Sequence& s = sequences_[id];
+    end = std::min(end, views_[id].data_len);
+    begin = std::min(begin, end);
+    buffer->resize(end - begin);
+    if (begin == end)
+        return;
+    char* data = &(*buffer)[0];
+
+    // Decode a word at a time
+    std::uint64_t pos = s.offset + begin;
+    for (std::uint32_t i = 0, len = end - begin; i < len;) {
+        std::uint64_t word = bases_[pos >> 5] >> (2 * (pos & 31));
+        std::uint32_t n = std::min<std::uint64_t>(32 - (pos & 31), len - i);
+        for (std::uint32_t j = 0; j < n; j++, word >>= 2)
+            data[i++] = kDecode[word & 3];
+        pos += n;
+    }
+    ApplyRuns(n_runs_, s.n_begin, s.n_end, begin, end, false, data);
+    ApplyRuns(lower_runs_, s.lower_begin, s.lower_end, begin, end, true, data);
+
+    if (!strand) {
+        std::reverse(buffer->begin(), buffer->end());
+        for (auto& c : *buffer)
+            c = Complement(c);
+    }
+}
+
+std::uint64_t ReferenceStore::memory_usage() const {
+    return bases_.size() * sizeof(std::uint64_t) +
+           (n_runs_.size() + lower_runs_.size()) *
+                   sizeof(std::pair<std::uint32_t, std::uint32_t>);
+}
+
+}  // namespace ivory
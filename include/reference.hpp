@@ -0,0 +1,74 @@
+// Copyright (c) 2021 Lovro Vrcek
+
+#ifndef INCLUDE_REFERENCE_HPP_
+#define INCLUDE_REFERENCE_HPP_
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "reader.hpp"
+
+namespace ivory {
+
+// Sequences packed into 2 bits per base. Bases other than ACGT are kept as
+// sorted runs of N and lowercase bases as sorted runs of masked positions,
+// so that any window is restored as it was added, except that IUPAC codes
+// such as R and Y come back as N.
+class ReferenceStore {
+ public:
+    ReferenceStore() = default;
+
+    ReferenceStore(const ReferenceStore&) = delete;
+    ReferenceStore& operator=(const ReferenceStore&) = delete;
+
+    void Add(const SequenceView& sequence);
+
+    std::size_t size() const {
+        return sequences_.size();
+    }
+
+    // Name and length of a sequence, its data is nullptr
+    const SequenceView& view(std::size_t id) const {
+        return views_[id];
+    }
+
+    const std::vector<SequenceView>& views() const {
+        return views_;
+    }
+
+    // Stores bases [begin, end) of a sequence into buffer, or their reverse
+    // complement if strand is false. Reusing the buffer avoids allocations.
+    void Extract(std::size_t id, std::uint32_t begin, std::uint32_t end,
+                 bool strand, std::string* buffer) const;
+
+    // Bytes used by the packed bases and the runs
+    std::uint64_t memory_usage() const;
+
+ private:
+    typedef std::vector<std::pair<std::uint32_t, std::uint32_t>> Runs;
+
+    struct Sequence {
+        std::uint64_t offset;  // of the first base in bases_
+        std::size_t n_begin, n_end;
+        std::size_t lower_begin, lower_end;
+    };
+
+    static void ApplyRuns(const Runs& runs, std::size_t runs_begin,
+                          std::size_t runs_end, std::uint32_t begin,
+                          std::uint32_t end, bool lower, char* data);
+
+    std::vector<std::uint64_t> bases_;  // 32 bases per word
+    std::uint64_t num_bases_ = 0;
+    Runs n_runs_;  // [begin, end) positions within their sequence
+    Runs lower_runs_;
+    std::vector<Sequence> sequences_;
+    std::deque<std::string> names_;  // stable for the views
+    std::vector<SequenceView> views_;
+};
+
+}  // namespace ivory
+
+#endif  // INCLUDE_REFERENCE_HPP_
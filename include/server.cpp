@@ -0,0 +1,270 @@
+// Copyright (c) 2021 Lovro Vrcek
+
+#include "server.hpp"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+
+namespace ivory {
+
+namespace {
+
+const std::size_t kChunkSize = 1 << 20;
+// Pause after a failed accept, e.g. when out of descriptors
+const std::chrono::milliseconds kAcceptRetryDelay(100);
+
+// Write end of the stop pipe of the server with signal handlers
+int signal_stop_fd = -1;
+
+void StopOnSignal(int signum) {
+    signal(signum, SIG_DFL);
+    if (signal_stop_fd >= 0) {
+        char c = 0;
+        ssize_t n = write(signal_stop_fd, &c, 1);
+        (void) n;
+    }
+}
+
+std::runtime_error Error(const std::string& message) {
+    return std::runtime_error("[ivory::UnixServer] error: " + message + ": " +
+                              strerror(errno));
+}
+
+sockaddr_un Address(const std::string& path) {
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        errno = ENAMETOOLONG;
+        throw Error("invalid socket path " + path);
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size());
+    return address;
+}
+
+bool WriteAll(int fd, const char* data, std::size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, data, len);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += written;
+        len -= written;
+    }
+    return true;
+}
+
+}  // namespace
+
+UnixServer::UnixServer(const std::string& path)
+        : path_(path),
+          fd_(-1) {
+    sockaddr_un address = Address(path);
+
+    // A socket nobody listens on is left over by a server which was killed
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            errno = EEXIST;
+            throw Error("unable to create socket " + path);
+        }
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        bool live = fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&address),  // NOLINT
+                                       sizeof(address)) == 0;
+        if (fd >= 0)
+            close(fd);
+        if (live) {
+            errno = EADDRINUSE;
+            throw Error("unable to create socket " + path);
+        }
+        unlink(path.c_str());
+    }
+
+    fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd_ < 0)
+        throw Error("unable to create socket " + path);
+    if (bind(fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||  // NOLINT
+            listen(fd_, SOMAXCONN) != 0) {
+        close(fd_);
+        throw Error("unable to listen on socket " + path);
+    }
+    if (pipe(stop_pipe_) != 0) {
+        close(fd_);
+        unlink(path.c_str());
+        throw Error("unable to create socket " + path);
+    }
+    num_connections_ = 0;
+    stopped_ = false;
+}
+
+UnixServer::~UnixServer() {
+    if (signal_stop_fd == stop_pipe_[1])
+        signal_stop_fd = -1;
+    close(stop_pipe_[0]);
+    close(stop_pipe_[1]);
+    close(fd_);
+    unlink(path_.c_str());
+}
+
+void UnixServer::InstallSignalHandlers() {
+    signal_stop_fd = stop_pipe_[1];
+    signal(SIGINT, StopOnSignal);
+    signal(SIGTERM, StopOnSignal);
+    signal(SIGPIPE, SIG_IGN);
+}
+
+void UnixServer::Serve(const std::function<void(int)>& handler,
+                       unsigned int max_connections) {
+    while (true) {
+        pollfd fds[2] = {{fd_, POLLIN, 0}, {stop_pipe_[0], POLLIN, 0}};
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            throw Error("unable to accept connection");
+        }
+        if ((fds[1].revents & POLLIN) != 0) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopped_ = true;
+            break;
+        }
+        if ((fds[0].revents & POLLIN) == 0)
+            continue;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            condition_.wait(lock, [this, max_connections] () {
+                return stopped_ || num_connections_ < max_connections;
+            });
+            if (stopped_)
+                break;
+        }
+        int fd = accept(fd_, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EBADF || errno == EINVAL || errno == ENOTSOCK)
+                throw Error("unable to accept connection");
+            if (errno != EINTR && errno != ECONNABORTED &&
+                    errno != EAGAIN && errno != EWOULDBLOCK) {
+                std::cerr << "[ivory::UnixServer] unable to accept connection: "
+                          << strerror(errno) << std::endl;
+                std::this_thread::sleep_for(kAcceptRetryDelay);
+            }
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        try {
+            std::thread([this, handler, fd] () {
+                handler(fd);
+                std::lock_guard<std::mutex> lock(mutex_);
+                --num_connections_;
+                condition_.notify_all();
+            }).detach();
+            ++num_connections_;
+        } catch (const std::system_error& e) {
+            std::cerr << "[ivory::UnixServer] unable to handle connection: "
+                      << e.what() << std::endl;
+            close(fd);
+        }
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    condition_.wait(lock, [this] () { return num_connections_ == 0; });
+}
+
+void UnixServer::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopped_ = true;
+    }
+    condition_.notify_all();
+    char c = 0;
+    ssize_t n = write(stop_pipe_[1], &c, 1);
+    (void) n;
+}
+
+int ConnectUnix(const std::string& path) {
+    sockaddr_un address = Address(path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        throw Error("unable to create socket");
+    if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {  // NOLINT
+        close(fd);
+        throw Error("unable to connect to " + path);
+    }
+    return fd;
+}
+
+bool SendResponseEnd(int fd, const std::string& error) {
+    std::string end(1, '\0');
+    end += error;
+    return WriteAll(fd, end.data(), end.size());
+}
+
+void SendRequest(int fd, int socket) {
+    std::vector<char> buffer(kChunkSize);
+    while (true) {
+        ssize_t n = read(fd, buffer.data(), buffer.size());
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            throw Error("unable to read request");
+        if (n == 0)
+            break;
+        if (!WriteAll(socket, buffer.data(), n))
+            throw Error("unable to send request");
+    }
+    shutdown(socket, SHUT_WR);
+}
+
+std::string ReceiveResponse(int socket, OutputWriter* output) {
+    std::vector<char> buffer(kChunkSize);
+    std::string error;
+    bool ended = false;
+    while (true) {
+        ssize_t n = read(socket, buffer.data(), buffer.size());
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            throw Error("unable to receive response");
+        if (n == 0)
+            break;
+        if (ended) {
+            error.append(buffer.data(), n);
+            continue;
+        }
+        const char* end = static_cast<const char*>(
+                std::memchr(buffer.data(), '\0', n));
+        if (end == nullptr) {
+            output->Write(buffer.data(), n);
+            continue;
+        }
+        output->Write(buffer.data(), end - buffer.data());
+        error.assign(end + 1, buffer.data() + n - end - 1);
+        ended = true;
+    }
+    if (!ended) {
+        errno = ECONNRESET;
+        throw Error("unable to receive response");
+    }
+    return error;
+}
+
+}  // namespace ivory
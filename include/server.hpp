@@ -0,0 +1,75 @@
+// Copyright (c) 2021 Lovro Vrcek
+
+#ifndef INCLUDE_SERVER_HPP_
+#define INCLUDE_SERVER_HPP_
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+
+#include "output.hpp"
+
+namespace ivory {
+
+// Requests and responses are raw byte streams over a Unix domain socket. The
+// client sends the whole request and shuts down its side for writing, while
+// the server streams the response back, followed by a NUL byte and an error
+// message which is empty on success.
+
+// Listens on a Unix domain socket, handling each connection on a thread of
+// its own until stopped. The socket file is removed on destruction.
+class UnixServer {
+ public:
+    // Replaces a stale socket left at path, throws std::runtime_error if the
+    // path is taken by another file or a live server
+    explicit UnixServer(const std::string& path);
+
+    UnixServer(const UnixServer&) = delete;
+    UnixServer& operator=(const UnixServer&) = delete;
+
+    ~UnixServer();
+
+    // Makes the first SIGINT or SIGTERM stop the server, while the second
+    // one terminates the process, and ignores SIGPIPE so that clients which
+    // disconnect early do not. Meant for the only server of a process.
+    void InstallSignalHandlers();
+
+    // Accepts connections until Stop is called, handler takes over the
+    // descriptor of each one. At most max_connections are handled at once,
+    // further clients wait in the backlog. Returns once the running handlers
+    // are done, throws std::runtime_error if the socket fails.
+    void Serve(const std::function<void(int)>& handler,
+               unsigned int max_connections);
+
+    // Makes Serve return, can be called from any thread
+    void Stop();
+
+ private:
+    std::string path_;
+    int fd_;
+    int stop_pipe_[2];  // Stop writes a byte to wake up Serve
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    unsigned int num_connections_;  // guarded by mutex_
+    bool stopped_;  // guarded by mutex_
+};
+
+// Throws std::runtime_error if nobody listens on path
+int ConnectUnix(const std::string& path);
+
+// Ends the response, returns false if the client is gone
+bool SendResponseEnd(int fd, const std::string& error);
+
+// Copies the input from fd to the socket and shuts it down for writing,
+// throws std::runtime_error on failure
+void SendRequest(int fd, int socket);
+
+// Copies the response to output and returns the error message of the
+// server, throws std::runtime_error if the connection is lost before the
+// response ends
+std::string ReceiveResponse(int socket, OutputWriter* output);
+
+}  // namespace ivory
+
+#endif  // INCLUDE_SERVER_HPP_
@@ -0,0 +1,51 @@
+// Copyright (c) 2021 Lovro Vrcek
+
+#include "statistics.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include <vector>
+
+
+namespace ivory {
+
+void LengthStatistics::Add(std::uint64_t length) {
+    histogram_[length]++;
+    num_sequences_++;
+    total_length_ += length;
+    min_length_ = std::min(min_length_, length);
+    max_length_ = std::max(max_length_, length);
+}
+
+void LengthStatistics::Merge(const LengthStatistics& other) {
+    for (auto& it : other.histogram_)
+        histogram_[it.first] += it.second;
+    num_sequences_ += other.num_sequences_;
+    total_length_ += other.total_length_;
+    min_length_ = std::min(min_length_, other.min_length_);
+    max_length_ = std::max(max_length_, other.max_length_);
+}
+
+std::uint64_t LengthStatistics::Nx(double fraction) const {
+    return NGx(fraction, total_length_);
+}
+
+std::uint64_t LengthStatistics::NGx(double fraction,
+                                    std::uint64_t genome_size) const {
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> lengths(
+            histogram_.begin(), histogram_.end());
+    std::sort(lengths.begin(), lengths.end(),
+              std::greater<std::pair<std::uint64_t, std::uint64_t>>());
+
+    double threshold = fraction * genome_size;
+    std::uint64_t sum = 0;
+    for (auto& it : lengths) {
+        sum += it.first * it.second;
+        if (sum >= threshold)
+            return it.first;
+    }
+    return 0;
+}
+
+}  // namespace ivory
@@ -0,0 +1,59 @@
+// Copyright (c) 2021 Lovro Vrcek
+
+#ifndef INCLUDE_STATISTICS_HPP_
+#define INCLUDE_STATISTICS_HPP_
+
+#include <cstdint>
+#include <unordered_map>
+
+namespace ivory {
+
+// Sequence length statistics accumulated one length at a time. Lengths are
+// kept as an exact histogram, whose size is bounded by the number of
+// distinct lengths rather than the number of sequences.
+class LengthStatistics {
+ public:
+    void Add(std::uint64_t length);
+
+    void Merge(const LengthStatistics& other);
+
+    std::uint64_t num_sequences() const {
+        return num_sequences_;
+    }
+
+    std::uint64_t total_length() const {
+        return total_length_;
+    }
+
+    // Zero for empty statistics
+    std::uint64_t min_length() const {
+        return num_sequences_ == 0 ? 0 : min_length_;
+    }
+
+    std::uint64_t max_length() const {
+        return max_length_;
+    }
+
+    std::uint64_t mean_length() const {
+        return num_sequences_ == 0 ? 0 : total_length_ / num_sequences_;
+    }
+
+    // Largest length such that the sequences at least as long cover the
+    // given fraction of the total length, e.g. N50 for 0.5
+    std::uint64_t Nx(double fraction) const;
+
+    // Same as Nx, but relative to the genome size instead of the total
+    // length, zero if the sequences do not cover enough of the genome
+    std::uint64_t NGx(double fraction, std::uint64_t genome_size) const;
+
+ private:
+    std::unordered_map<std::uint64_t, std::uint64_t> histogram_;
+    std::uint64_t num_sequences_ = 0;
+    std::uint64_t total_length_ = 0;
+    std::uint64_t min_length_ = UINT64_MAX;
+    std::uint64_t max_length_ = 0;
+};
+
+}  // namespace ivory
+
+#endif  // INCLUDE_STATISTICS_HPP_
@@ -0,0 +1,147 @@
+// Copyright (c) 2021 Lovro Vrcek
+
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+namespace ivory {
+
+namespace {
+
+thread_local const ThreadPool* current_pool = nullptr;
+thread_local unsigned int current_id = 0;
+
+}  // namespace
+
+ThreadPool::ThreadPool(unsigned int num_threads)
+        : pending_(0),
+          done_(false),
+          next_queue_(0) {
+    num_threads = std::max(num_threads, 1U);
+    for (unsigned int i = 0; i < num_threads; i++)
+        queues_.emplace_back(new Queue());
+    for (unsigned int i = 0; i < num_threads; i++)
+        workers_.emplace_back(&ThreadPool::Worker, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        done_ = true;
+    }
+    condition_.notify_all();
+    for (auto& it : workers_)
+        it.join();
+}
+
+int ThreadPool::ThreadId() const {
+    return current_pool == this ? static_cast<int>(current_id) : -1;
+}
+
+void ThreadPool::Push(std::function<void()> task) {
+    // Workers feed themselves, other threads spread tasks round robin
+    unsigned int id = current_pool == this ? current_id :
+            next_queue_++ % queues_.size();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++pending_;
+    }
+    {
+        std::lock_guard<std::mutex> lock(queues_[id]->mutex);
+        queues_[id]->tasks.emplace_back(std::move(task));
+    }
+    condition_.notify_one();
+}
+
+bool ThreadPool::Pop(unsigned int id, std::function<void()>* task) {
+    for (unsigned int i = 0; i < queues_.size(); i++) {
+        Queue& queue = *queues_[(id + i) % queues_.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty())
+            continue;
+        if (i == 0) {
+            *task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        } else {
+            *task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::Worker(unsigned int id) {
+    current_pool = this;
+    current_id = id;
+
+    std::function<void()> task;
+    while (true) {
+        if (Pop(id, &task)) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                --pending_;
+            }
+            task();
+            task = nullptr;
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        condition_.wait(lock, [this] () { return done_ || pending_ > 0; });
+        if (done_ && pending_ == 0)
+            return;
+    }
+}
+
+void ThreadPool::ParallelFor(
+        std::size_t n,
+        const std::function<void(std::size_t, unsigned int)>& fn) {
+    auto finished = std::make_shared<std::promise<void>>();
+    std::future<void> result = finished->get_future();
+    ParallelForAsync(n, fn, [finished] () { finished->set_value(); });
+    result.wait();
+}
+
+void ThreadPool::ParallelForAsync(
+        std::size_t n,
+        std::function<void(std::size_t, unsigned int)> fn,
+        std::function<void()> done) {
+    if (n == 0) {
+        done();
+        return;
+    }
+
+    std::vector<std::pair<std::size_t, std::size_t>> batches;
+    for (std::size_t begin = 0, end; begin < n; begin = end) {
+        std::size_t batch_size = std::max<std::size_t>(
+                1, (n - begin) / (2 * num_threads()));
+        end = std::min(n, begin + batch_size);
+        batches.emplace_back(begin, end);
+    }
+
+    auto shared_fn = std::make_shared<
+            std::function<void(std::size_t, unsigned int)>>(std::move(fn));
+    auto shared_done = std::make_shared<std::function<void()>>(std::move(done));
+    auto remaining = std::make_shared<std::atomic<std::size_t>>(batches.size());
+    for (auto& it : batches) {
+        std::size_t begin = it.first, end = it.second;
+        Push([shared_fn, shared_done, remaining, begin, end] () {
+            unsigned int id = current_id;
+            for (std::size_t i = begin; i < end; i++)
+                (*shared_fn)(i, id);
+            if (--(*remaining) == 0)
+                (*shared_done)();
+        });
+    }
+}
+
+}  // namespace ivory
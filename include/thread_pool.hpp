@@ -0,0 +1,88 @@
+// Copyright (c) 2021 Lovro Vrcek
+
+#ifndef INCLUDE_THREAD_POOL_HPP_
+#define INCLUDE_THREAD_POOL_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace ivory {
+
+// Work-stealing thread pool, each worker pops tasks from the back of its own
+// deque and steals from the front of the other deques once it runs dry
+class ThreadPool {
+ public:
+    explicit ThreadPool(
+            unsigned int num_threads = std::thread::hardware_concurrency());
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool();
+
+    unsigned int num_threads() const {
+        return workers_.size();
+    }
+
+    // Index of the calling worker in [0, num_threads), or -1 if the caller
+    // is not a worker of this pool
+    int ThreadId() const;
+
+    template<typename F, typename... Args>
+    std::future<typename std::result_of<F(Args...)>::type> Submit(
+            F&& f, Args&&... args) {
+        typedef typename std::result_of<F(Args...)>::type R;
+        auto task = std::make_shared<std::packaged_task<R()>>(
+                std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+        std::future<R> result = task->get_future();
+        Push([task] () { (*task)(); });
+        return result;
+    }
+
+    // Calls fn(i, thread_id) for each i in [0, n) and waits for all calls
+    // to finish. Indices are handed out in batches whose size decreases with
+    // the remaining work, so a few expensive items at the end cannot leave
+    // the other workers idle. Must not be called from a worker of this pool.
+    void ParallelFor(std::size_t n,
+                     const std::function<void(std::size_t, unsigned int)>& fn);
+
+    // Same as ParallelFor but returns immediately, done() is called by the
+    // worker which finishes the last index
+    void ParallelForAsync(std::size_t n,
+                          std::function<void(std::size_t, unsigned int)> fn,
+                          std::function<void()> done);
+
+ private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void Push(std::function<void()> task);
+
+    bool Pop(unsigned int id, std::function<void()>* task);
+
+    void Worker(unsigned int id);
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    std::size_t pending_;  // guarded by mutex_
+    bool done_;  // guarded by mutex_
+    std::atomic<unsigned int> next_queue_;
+};
+
+}  // namespace ivory
+
+#endif  // INCLUDE_THREAD_POOL_HPP_
@@ -0,0 +1,123 @@
+// Copyright (c) 2021 Lovro Vrcek
+
+#include <getopt.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "ivory_config.hpp"
+#include "evaluation.hpp"
+
+
+void PrintHelp() {
+    std::cout <<
+            "usage: ivory_eval [options ...] <baseline> <compared>\n"
+            "\n"
+            "  <baseline>\n"
+            "    PAF file with the reference overlaps, e.g. of minimap2 or a\n"
+            "    previous version (can be compressed with gzip)\n"
+            "  <compared>\n"
+            "    PAF file with the evaluated overlaps, listing the reads in the\n"  // NOLINT
+            "    same order (can be compressed with gzip)\n"
+            "  options:\n"
+            "    -e <int>\n"
+            "      maximal difference of matched overlap coordinates (default: 100)\n"  // NOLINT
+            "    -m <file>\n"
+            "      write the reads with unmatched overlaps as their name and the\n"  // NOLINT
+            "      number of baseline, compared and matched overlaps\n"
+            "    -v, --version\n"
+            "      print the version of the program\n"
+            "    -h, --help\n"
+            "      show help\n";
+}
+
+int main(int argc, char** argv) {
+    unsigned int epsilon = 100;
+    std::string mismatches_path;
+
+    const char* short_opts = "vhe:m:";
+    const option long_opts[] = {
+        {"version", no_argument, nullptr, 'v'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, no_argument, nullptr, 0}
+    };
+    while (true) {
+        const auto opt = getopt_long(argc, argv, short_opts, long_opts,
+                                     nullptr);
+        if (opt == -1)
+            break;
+        switch (opt) {
+            case 'v':
+                std::cout << "v" << VERSION << std::endl;
+                return 0;
+            case 'h':
+                PrintHelp();
+                return 0;
+            case 'e':
+                epsilon = std::max(atoi(optarg), 0);
+                break;
+            case 'm':
+                mismatches_path = optarg;
+                break;
+            case '?':
+            default:
+                PrintHelp();
+                return 1;
+        }
+    }
+
+    if (argc - optind != 2) {
+        std::cerr << "Error: Expected a baseline and a compared PAF file"
+                  << std::endl;
+        PrintHelp();
+        return 1;
+    }
+
+    std::unique_ptr<std::ofstream> mismatches;
+    if (!mismatches_path.empty()) {
+        mismatches.reset(new std::ofstream(mismatches_path));
+        if (!*mismatches) {
+            std::cerr << "Error: Unable to write " << mismatches_path
+                      << std::endl;
+            return 1;
+        }
+    }
+
+    ivory::Evaluation evaluation;
+    try {
+        evaluation = ivory::ComparePaf(argv[optind], argv[optind + 1],
+                                       epsilon, mismatches.get());
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    if (evaluation.overflow_reads > 0) {
+        std::cerr << "Warning: " << evaluation.overflow_reads
+                  << " reads were counted as missing from the other file "
+                     "after too many reads in a row missing from one file, "
+                     "check that both list the reads in the same order"
+                  << std::endl;
+    }
+
+    std::cout <<
+            "Baseline overlaps\t=\t" << evaluation.baseline_overlaps << "\n" <<
+            "Compared overlaps\t=\t" << evaluation.compared_overlaps << "\n" <<
+            "Matched overlaps\t=\t" << evaluation.matched_overlaps << "\n" <<
+            "Precision\t\t=\t" << evaluation.precision() << "\n" <<
+            "Recall\t\t\t=\t" << evaluation.recall() << "\n" <<
+            "Jaccard index\t\t=\t" << evaluation.jaccard() << "\n" <<
+            "Baseline reads\t\t=\t" << evaluation.baseline_reads << "\n" <<
+            "Compared reads\t\t=\t" << evaluation.compared_reads << "\n" <<
+            "Baseline only reads\t=\t" << evaluation.baseline_only_reads <<
+            "\n" <<
+            "Compared only reads\t=\t" << evaluation.compared_only_reads <<
+            "\n" <<
+            "Mismatched reads\t=\t" << evaluation.mismatched_reads <<
+            std::endl;
+    return 0;
+}
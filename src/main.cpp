@@ -1,103 +1,301 @@
 // Copyright (c) 2021 Lovro Vrcek
 
-#include <unistd.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <signal.h>
 #include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <iomanip>
 #include <iostream>
 #include <vector>
 #include <string>
 #include <algorithm>
 #include <map>
-
-#include "bioparser/fasta_parser.hpp"
-#include "bioparser/fastq_parser.hpp"
+#include <memory>
+#include <stdexcept>
+#include <thread>
 
 #include "ivory_config.hpp"
 #include "aligner.hpp"
+#include "dust.hpp"
 #include "minimizer.hpp"
+#include "output.hpp"
+#include "pipeline.hpp"
+#include "profile.hpp"
+#include "reader.hpp"
+#include "reference.hpp"
+#include "server.hpp"
+#include "statistics.hpp"
+#include "thread_pool.hpp"
 
 
-struct Sequence {
- public:
-    std::string name;
-    std::string data;
-    std::string quality;
+struct Options {
+    bool align = false;
+    bool chain = false;
+    ivory::AlignmentType type = ivory::global;
+    int match = 3;
+    int mismatch = -5;
+    int gap = -4;
+    unsigned int kmer_len = 15;
+    unsigned int window_len = 10;
+    double frequency = 0.001;
+    unsigned int min_quality = 0;
+    unsigned int dust_threshold = 0;
+    unsigned int rescue_kmer_len = 0;
+    unsigned int rescue_window_len = 5;
+    std::string dust_bed_path;
+    unsigned int num_threads = 1;
+    std::uint64_t batch_size = 64ULL << 20;
+    std::uint64_t max_memory = 1ULL << 30;
+    bool sam = false;
+    bool ava = false;
+    std::uint64_t index_size = 4096ULL << 20;
+    bool stats_only = false;
+    std::uint64_t genome_size = 0;
+    std::string report_path;
+    std::string serve_path;
+    std::string connect_path;
+};
 
-    Sequence(const char* name, std::uint32_t name_len,
-             const char* data, std::uint32_t data_len) :
-                  name(name, name_len),
-                  data(data, data_len) {}
+void PrintStatistics(const ivory::LengthStatistics& stats,
+                     const std::string& title,
+                     std::uint64_t genome_size,
+                     std::ostream& out) {
+    out << "\n--------------- " << title << " ---------------\n" <<
+            "Number of sequences\t=\t" << stats.num_sequences() << std::endl <<
+            "Total length\t\t=\t" << stats.total_length() << std::endl <<
+            "Minimal length\t\t=\t" << stats.min_length() << std::endl <<
+            "Maximal length\t\t=\t" << stats.max_length() << std::endl <<
+            "Mean length\t\t=\t" << stats.mean_length() << std::endl <<
+            "N50 value\t\t=\t" << stats.Nx(0.5) << std::endl <<
+            "N90 value\t\t=\t" << stats.Nx(0.9) << std::endl;
+    if (genome_size > 0) {
+        out << "NG50 value\t\t=\t" << stats.NGx(0.5, genome_size)
+            << std::endl;
+    }
+}
 
-    Sequence(const char* name, std::uint32_t name_len,
-             const char* data, std::uint32_t data_len,
-             const char* quality, std::uint32_t quality_len) :
-                  name(name, name_len),
-                  data(data, data_len),
-                  quality(quality, quality_len) {}
-};
+// Quotes the string as a JSON value
+std::string JsonString(const char* s, std::size_t len) {
+    std::string quoted = "\"";
+    for (std::size_t i = 0; i < len; i++) {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+            quoted += c;
+        } else if (c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            quoted += escaped;
+        } else {
+            quoted += c;
+        }
+    }
+    return quoted + '"';
+}
 
-void PrintStatistics(const std::vector<std::unique_ptr<Sequence>>& sequences,
-                     int mode) {
-    int num_sequences = sequences.size();
-    int total_len = 0, n50_sum = 0;
-    int min_len, max_len, mean_len, n50;
-    std::vector<int> lengths;
+void WriteStatistics(const ivory::LengthStatistics& stats,
+                     std::ostream& out) {
+    out << "{\"num_sequences\": " << stats.num_sequences() <<
+            ", \"total_length\": " << stats.total_length() <<
+            ", \"min_length\": " << stats.min_length() <<
+            ", \"max_length\": " << stats.max_length() <<
+            ", \"mean_length\": " << stats.mean_length() <<
+            ", \"n50\": " << stats.Nx(0.5) <<
+            ", \"n90\": " << stats.Nx(0.9) << "}";
+}
 
-    for (auto it = sequences.begin(); it != sequences.end(); it++) {
-        lengths.push_back((*it)->data.size());
-        total_len += (*it)->data.size();
+// Writes the JSON report of the run, statistics are omitted if null. The
+// counters, stage times and latencies stay zero unless built with
+// IVORY_PROFILE.
+void WriteReport(std::ostream& out,
+                 const Options& options,
+                 double wall_time,
+                 const ivory::LengthStatistics* reference_stats,
+                 const ivory::LengthStatistics* fragment_stats) {
+    ivory::ProfileReport profile = ivory::CollectProfile();
+    auto seconds = [] (std::uint64_t ns) {
+        return ns / 1e9;
+    };
+    auto microseconds = [] (std::uint64_t ns) {
+        return ns / 1e3;
+    };
+
+    out << std::fixed << std::setprecision(3);
+    out << "{\n" <<
+            "  \"version\": \"" << VERSION << "\",\n" <<
+#ifdef IVORY_PROFILE
+            "  \"instrumented\": true,\n" <<
+#else
+            "  \"instrumented\": false,\n" <<
+#endif
+            "  \"threads\": " << options.num_threads << ",\n" <<
+            "  \"wall_time_s\": " << wall_time << ",\n" <<
+            "  \"peak_rss_kb\": " << ivory::PeakRss() << ",\n";
+    if (reference_stats != nullptr) {
+        out << "  \"reference\": ";
+        WriteStatistics(*reference_stats, out);
+        out << ",\n";
+    }
+    if (fragment_stats != nullptr) {
+        out << "  \"fragments\": ";
+        WriteStatistics(*fragment_stats, out);
+        out << ",\n";
     }
 
-    std::sort(lengths.begin(), lengths.end(), [](int a, int b) {return a > b;});
-    max_len = lengths[0];
-    min_len = lengths[num_sequences-1];
-    mean_len = total_len / num_sequences;
+    out << "  \"counters\": {";
+    for (int i = 0; i < ivory::kNumProfileCounters; i++) {
+        out << (i == 0 ? "" : ", ") << "\"" << ivory::kProfileCounterNames[i]
+            << "\": " << profile.counters[i];
+    }
+    out << "},\n";
 
-    for (int i = 0; i < num_sequences; i++) {
-        n50_sum += lengths[i];
-        if (n50_sum >= total_len * 0.5) {
-            n50 = lengths[i];
-            break;
-        }
+    // Times are summed over the threads
+    out << "  \"stages\": {";
+    for (int i = 0; i < ivory::kNumProfileStages; i++) {
+        out << (i == 0 ? "" : ", ") << "\"" << ivory::kProfileStageNames[i]
+            << "\": {\"wall_s\": " << seconds(profile.wall_ns[i])
+            << ", \"cpu_s\": " << seconds(profile.cpu_ns[i]) << "}";
     }
+    out << "},\n";
 
-    if (mode == 1)
-        std::cerr << "\n--------------- Reference Statistics ---------------\n";
-    else
-        std::cerr << "\n--------------- Fragments Statistics ---------------\n";
+    out << "  \"read_latency_us\": {\"count\": " << profile.num_reads <<
+            ", \"p50\": " << microseconds(profile.LatencyPercentile(0.5)) <<
+            ", \"p90\": " << microseconds(profile.LatencyPercentile(0.9)) <<
+            ", \"p99\": " << microseconds(profile.LatencyPercentile(0.99)) <<
+            ", \"p999\": " << microseconds(profile.LatencyPercentile(0.999)) <<
+            ", \"max\": " << microseconds(profile.max_latency_ns) << "},\n";
 
-    std::cerr <<
-            "Number of sequences\t=\t" << num_sequences << std::endl <<
-            "Total length\t\t=\t" << total_len << std::endl <<
-            "Minimal length\t\t=\t" << min_len << std::endl <<
-            "Maximal length\t\t=\t" << max_len << std::endl <<
-            "Mean length\t\t=\t" << mean_len << std::endl <<
-            "N50 value\t\t=\t" << n50 << std::endl;
+    out << "  \"slowest_reads\": [";
+    for (std::size_t i = 0; i < profile.slowest_reads.size(); i++) {
+        auto& it = profile.slowest_reads[i];
+        out << (i == 0 ? "" : ", ") << "{\"name\": " <<
+                JsonString(it.second.data(), it.second.size()) <<
+                ", \"latency_us\": " << microseconds(it.first) << "}";
+    }
+    out << "]\n}\n";
 }
 
 void PrintHelp() {
     std::cout <<
             "usage: ivory_mapper [options ...] <reference> <fragments> [<fragments> ...]\n"  // NOLINT
+            "       ivory_mapper -x ava [options ...] <fragments> [<fragments> ...]\n"  // NOLINT
+            "       ivory_mapper --stats-only [options ...] <fragments> [<fragments> ...]\n"  // NOLINT
+            "       ivory_mapper --serve <socket> [options ...] <reference>\n"  // NOLINT
+            "       ivory_mapper --connect <socket> <fragments> [<fragments> ...]\n"  // NOLINT
             "\n"
             "  <reference>\n"
             "    input file containing reference in FASTA format (can be compressed with gzip)\n"  // NOLINT
             "  <fragments>\n"
             "    input file containing fragments in FASTA/Q format (can be compressed with gzip)\n"  // NOLINT
             "  options:\n"
+            "    -c\n"
+            "      calculate alignment and output CIGAR strings (default: false)\n"  // NOLINT
+            "    -a <str>\n"
+            "      alignment type, one of global, local, semiglobal or chain, which\n"  // NOLINT
+            "      aligns only the gaps between the minimizer matches of an overlap\n"  // NOLINT
+            "      and extends its ends (default: global)\n"
+            "    -m <int>\n"
+            "      match cost (default: 3)\n"
+            "    -n <int>\n"
+            "      mismatch cost (default: -5)\n"
+            "    -g <int>\n"
+            "      gap cost (default: -4)\n"
+            "    -k <int>\n"
+            "      k-mer size, at most 16 (default: 15)\n"
+            "    -w <int>\n"
+            "      window size (default: 10)\n"
+            "    -f <float>\n"
+            "      fraction of most frequent minimizers to ignore (default: 0.001)\n"  // NOLINT
+            "    -q <int>\n"
+            "      minimum base quality of FASTQ fragments, k-mers covering lower\n"  // NOLINT
+            "      quality bases are not used as seeds (default: 0)\n"
+            "    --dust <int>\n"
+            "      mask low complexity regions of the indexed sequences whose SDUST\n"  // NOLINT
+            "      score exceeds the threshold, e.g. 20 (default: 0, no masking)\n"  // NOLINT
+            "    --dust-bed <file>\n"
+            "      save the masked regions to a BED file\n"
+            "    --rescue-k <int>\n"
+            "      k-mer size of a second, denser index, with which the fragments\n"  // NOLINT
+            "      whose best chain spans less than 80% of them are seeded again,\n"  // NOLINT
+            "      at most 16, not with -x ava (default: 0, no rescue)\n"
+            "    --rescue-w <int>\n"
+            "      window size of the rescue index (default: 5)\n"
+            "    -t <int>\n"
+            "      number of threads (default: 1)\n"
+            "    -b <int>\n"
+            "      size of fragment batches in MB (default: 64)\n"
+            "    -M <int>\n"
+            "      memory budget for fragment batches in flight in MB (default: 1024)\n"  // NOLINT
+            "    -x <str>\n"
+            "      preset, ava overlaps the fragments with each other instead of\n"  // NOLINT
+            "      mapping them to a reference\n"
+            "    -I <int>\n"
+            "      bases of fragments indexed at once in all-vs-all mode in MB,\n"  // NOLINT
+            "      while all fragments stay in memory (default: 4096)\n"
+            "    -S, --sam\n"
+            "      output in SAM instead of PAF format, with -c only for global\n"  // NOLINT
+            "      and chain alignment\n"
+            "    --stats-only\n"
+            "      only print the length statistics of each file to stdout, the\n"  // NOLINT
+            "      files are streamed in parallel and need no reference\n"
+            "    --genome-size <int>\n"
+            "      genome size in bases for NG50, which defaults to the reference\n"  // NOLINT
+            "      length when mapping (default: 0, NG50 not printed otherwise)\n"  // NOLINT
+            "    --report <file>\n"
+            "      write a JSON report of the run time, peak memory and, if built\n"  // NOLINT
+            "      with IVORY_PROFILE, the counters and timings of each stage\n"  // NOLINT
+            "    --serve <socket>\n"
+            "      load the reference and its index once, then map the fragments\n"  // NOLINT
+            "      sent by clients over the Unix domain socket\n"
+            "    --connect <socket>\n"
+            "      send the fragments to a server and print its output, the\n"  // NOLINT
+            "      mapping options are those of the server\n"
             "    -v, --version\n"
             "      print the version of the program\n"
             "    -h, --help\n"
             "      show help\n";
 }
 
+// Values of the options without a short form
+const int kStatsOnly = 256;
+const int kGenomeSize = 257;
+const int kReport = 258;
+const int kServe = 259;
+const int kConnect = 260;
+const int kDust = 261;
+const int kDustBed = 262;
+const int kRescueK = 263;
+const int kRescueW = 264;
+
 void ProcessArgs(int argc, char** argv,
-                 std::vector<std::unique_ptr<Sequence>>* reference,
-                 std::vector<std::unique_ptr<Sequence>>* fragments) {
-    const char* short_opts = "vh";
+                 Options* options,
+                 std::string* reference_path,
+                 std::vector<std::string>* fragment_paths) {
+    const char* short_opts = "vhca:m:n:g:k:w:f:q:t:b:M:Sx:I:";
     const option long_opts[] = {
         {"version", no_argument, nullptr, 'v'},
         {"help", no_argument, nullptr, 'h'},
+        {"sam", no_argument, nullptr, 'S'},
+        {"stats-only", no_argument, nullptr, kStatsOnly},
+        {"genome-size", required_argument, nullptr, kGenomeSize},
+        {"report", required_argument, nullptr, kReport},
+        {"serve", required_argument, nullptr, kServe},
+        {"connect", required_argument, nullptr, kConnect},
+        {"dust", required_argument, nullptr, kDust},
+        {"dust-bed", required_argument, nullptr, kDustBed},
+        {"rescue-k", required_argument, nullptr, kRescueK},
+        {"rescue-w", required_argument, nullptr, kRescueW},
         {nullptr, no_argument, nullptr, 0}
     };
 
@@ -113,6 +311,95 @@ void ProcessArgs(int argc, char** argv,
             case 'h':
                 PrintHelp();
                 exit(0);
+            case 'c':
+                options->align = true;
+                break;
+            case 'a':
+                if (std::string(optarg) == "global") {
+                    options->type = ivory::global;
+                } else if (std::string(optarg) == "local") {
+                    options->type = ivory::local;
+                } else if (std::string(optarg) == "semiglobal") {
+                    options->type = ivory::semiglobal;
+                } else if (std::string(optarg) == "chain") {
+                    options->chain = true;
+                } else {
+                    std::cerr << "Error: Unknown alignment type" << std::endl;
+                    PrintHelp();
+                    exit(1);
+                }
+                break;
+            case 'm':
+                options->match = atoi(optarg);
+                break;
+            case 'n':
+                options->mismatch = atoi(optarg);
+                break;
+            case 'g':
+                options->gap = atoi(optarg);
+                break;
+            case 'k':
+                options->kmer_len = atoi(optarg);
+                break;
+            case 'w':
+                options->window_len = atoi(optarg);
+                break;
+            case 'f':
+                options->frequency = atof(optarg);
+                break;
+            case 'q':
+                options->min_quality = std::max(atoi(optarg), 0);
+                break;
+            case 't':
+                options->num_threads = atoi(optarg);
+                break;
+            case 'b':
+                options->batch_size = std::max(atoll(optarg), 1LL) << 20;
+                break;
+            case 'M':
+                options->max_memory = std::max(atoll(optarg), 1LL) << 20;
+                break;
+            case 'S':
+                options->sam = true;
+                break;
+            case 'x':
+                if (std::string(optarg) != "ava") {
+                    std::cerr << "Error: Unknown preset" << std::endl;
+                    PrintHelp();
+                    exit(1);
+                }
+                options->ava = true;
+                break;
+            case 'I':
+                options->index_size = std::max(atoll(optarg), 1LL) << 20;
+                break;
+            case kStatsOnly:
+                options->stats_only = true;
+                break;
+            case kGenomeSize:
+                options->genome_size = std::max(atoll(optarg), 0LL);
+                break;
+            case kReport:
+                options->report_path = optarg;
+                break;
+            case kServe:
+                options->serve_path = optarg;
+                break;
+            case kConnect:
+                options->connect_path = optarg;
+                break;
+            case kDust:
+                options->dust_threshold = std::max(atoi(optarg), 0);
+                break;
+            case kDustBed:
+                options->dust_bed_path = optarg;
+                break;
+            case kRescueK:
+                options->rescue_kmer_len = std::max(atoi(optarg), 0);
+                break;
+            case kRescueW:
+                options->rescue_window_len = atoi(optarg);
+                break;
             case '?':
             default:
                 PrintHelp();
@@ -120,6 +407,63 @@ void ProcessArgs(int argc, char** argv,
         }
     }
 
+    if (options->kmer_len < 1 || options->kmer_len > 16 ||
+        options->window_len < 1 || options->num_threads < 1) {
+        std::cerr << "Error: Invalid k-mer size, window size or number of threads"  // NOLINT
+                  << std::endl;
+        PrintHelp();
+        exit(1);
+    }
+
+    if (options->rescue_kmer_len > 16 || options->rescue_window_len < 1) {
+        std::cerr << "Error: Invalid rescue k-mer size or window size"
+                  << std::endl;
+        PrintHelp();
+        exit(1);
+    }
+
+    // Local and semiglobal alignments clip the query and target windows,
+    // which SAM records can not represent without their aligned span
+    if (options->sam && options->align && !options->chain &&
+        options->type != ivory::global) {
+        std::cerr << "Error: SAM output supports only global and chain alignment"  // NOLINT
+                  << std::endl;
+        exit(1);
+    }
+
+    if (options->ava && options->sam) {
+        std::cerr << "Error: SAM output is not supported in all-vs-all mode"
+                  << std::endl;
+        exit(1);
+    }
+
+    // Overlaps between fragments end where either fragment does, so most
+    // of them span less than 80% of the query and would all be rescued
+    if (options->ava && options->rescue_kmer_len > 0) {
+        std::cerr << "Error: --rescue-k is not supported in all-vs-all mode"
+                  << std::endl;
+        exit(1);
+    }
+
+    if (!options->dust_bed_path.empty() && options->dust_threshold == 0) {
+        std::cerr << "Error: --dust-bed requires a --dust threshold"
+                  << std::endl;
+        exit(1);
+    }
+
+    bool serve = !options->serve_path.empty();
+    bool connect = !options->connect_path.empty();
+    if ((serve || connect) && (options->ava || options->stats_only)) {
+        std::cerr << "Error: Server mode supports only mapping to a reference"
+                  << std::endl;
+        exit(1);
+    }
+    if (serve && connect) {
+        std::cerr << "Error: Only one of --serve and --connect can be given"
+                  << std::endl;
+        exit(1);
+    }
+
     if (optind >= argc) {
         std::cerr << "Error: Missing refernce and sequence files" << std::endl;
         PrintHelp();
@@ -133,19 +477,25 @@ void ProcessArgs(int argc, char** argv,
             return false;
     };
 
-    std::string path = argv[optind++];
-    if (!(ends_with(path, ".fasta") || ends_with(path, ".fasta.gz") ||
-          ends_with(path, ".fna") || ends_with(path, ".fna.gz") ||
-          ends_with(path, ".fa") || ends_with(path, ".fa.gz"))) {
-        std::cerr << "Error: Unsupported file type" << std::endl;
-        PrintHelp();
-        exit(1);
+    if (!options->ava && !options->stats_only && !connect) {
+        std::string path = argv[optind++];
+        if (!(ends_with(path, ".fasta") || ends_with(path, ".fasta.gz") ||
+              ends_with(path, ".fna") || ends_with(path, ".fna.gz") ||
+              ends_with(path, ".fa") || ends_with(path, ".fa.gz"))) {
+            std::cerr << "Error: Unsupported file type" << std::endl;
+            PrintHelp();
+            exit(1);
         }
+        *reference_path = path;
+    }
 
-    auto p = bioparser::Parser<Sequence>::Create<bioparser::FastaParser>(path);
-    *reference = p->Parse(-1);
+    if (serve && optind < argc) {
+        std::cerr << "Error: Fragments are sent by clients in server mode"
+                  << std::endl;
+        exit(1);
+    }
 
-    if (optind >= argc) {
+    if (optind >= argc && !serve) {
         std::cerr << "Error: Missing sequence file(s)" << std::endl;
         PrintHelp();
         exit(1);
@@ -162,76 +512,671 @@ void ProcessArgs(int argc, char** argv,
             PrintHelp();
             exit(1);
         }
+        fragment_paths->push_back(path);
+    }
+}
+
+// Appends the PAF or SAM lines of all overlaps between the fragment and the
+// targets to output. Sequence i of the lookup table is targets[offset + i],
+// and only ids lower than target_limit are considered. Target windows are
+// extracted from store into the reusable window buffer, so store may be
+// nullptr if no alignment is computed.
+void MapFragment(const ivory::SequenceView& fragment,
+                 const std::vector<ivory::SequenceView>& targets,
+                 const ivory::ReferenceStore* store,
+                 std::size_t offset,
+                 unsigned int target_limit,
+                 const ivory::Lookup& lookup,
+                 const ivory::RescueIndex* rescue,
+                 const Options& options,
+                 std::string* window,
+                 ivory::OutputBuffer* output) {
+    IVORY_TIME_READ(fragment.name, fragment.name_len);
+    std::vector<ivory::Overlap> overlaps = ivory::Map(
+            fragment.data, fragment.data_len, lookup,
+            options.kmer_len, options.window_len, target_limit,
+            fragment.quality, fragment.quality_len, options.min_quality,
+            rescue);
 
-        auto p = bioparser::Parser<Sequence>::Create<bioparser::FastaParser>(path);  // NOLINT
-        auto s = p->Parse(-1);
-        fragments->insert(fragments->end(),
-                          std::make_move_iterator(s.begin()),
-                          std::make_move_iterator(s.end()));
-    }
-}
-
-void VerboseTest(
-        const char* query, unsigned int query_len,
-        const char* target, unsigned int target_len,
-        ivory::AlignmentType type,
-        int match,
-        int mismatch,
-        int gap,
-        int gap_open,
-        int gap_extend,
-        bool matrix_print) {
-    std::string cigar;
-    unsigned int target_begin;
-
-    std::cout << "Query sequence: " << query << std::endl
-              << "Target sequence: " << target << std::endl;
-    int score = ivory::Align(
-            query, query_len,
-            target, target_len,
-            type, match, mismatch, gap,
-            gap_open, gap_extend,
-            &cigar, &target_begin,
-            matrix_print);
-    std::cout << "Alignment score: " << score << std::endl;
-    std::cout << "CIGAR string: " << cigar << std::endl;
-    std::cout << "Target begin: " << target_begin << std::endl  << std::endl;
-}
-
-void TestAligner() {
-    std::string cigar;
-    unsigned int target_begin;
-
-    VerboseTest("GATTACA", 7, "GCATGCU", 7, ivory::global,
-                1, -1, -1, 0, 0, true);
-    VerboseTest("ACCTAAGG", 8, "GGCTCAATCA", 10, ivory::local,
-                2, -1, -2, 0, 0, true);
-    VerboseTest("CGATAAA", 7, "ACTCCGAT", 8, ivory::semiglobal,
-                1, -1, -1, 0, 0, true);
-
-    VerboseTest("GATTACA", 7, "GCATGCU", 7, ivory::global,
-                1, -1, -1, -2, -1, true);
-    VerboseTest("ACCTAAGG", 8, "GGCTCAATCA", 10, ivory::local,
-                2, -1, -2, -3, -1, true);
-    VerboseTest("CGATAAA", 7, "ACTCCGAT", 8, ivory::semiglobal,
-                1, -1, -1, -2, -1, true);
-}
-
-void TestMinimizer() {
-    std::string test = "AAGCTCGGTAC";  // 11
-    std::cout << test << std::endl;
-    std::vector<std::tuple<unsigned int, unsigned int, bool>> v = ivory::Minimize(test.c_str(), 11, 3, 5);
-    std::vector<const char *> sequences = {"AAGCTCGGTAC", "CCAAGCAAGTTTG"};
-    std::vector<unsigned int> sequence_lens = {11, 13};
-    std::map<unsigned int, std::vector<std::tuple<unsigned int, bool , unsigned int>>> lookup;
-    ivory::Minimize(sequences, sequence_lens, 3, 5, &lookup);
+    for (auto& o : overlaps) {
+        std::size_t target_id = offset + o.target_id;
+        const ivory::SequenceView& target = targets[target_id];
+
+        // On the opposite strand the fragment is aligned to the reverse
+        // complement of the target window, and the CIGAR is reversed back.
+        // The insertions and deletions of Align are swapped into the SAM
+        // convention of AlignChain here, so both writers get the same CIGAR.
+        std::string cigar;
+        if (options.align && options.chain) {
+            IVORY_TIME(kAlignStage);
+            IVORY_COUNT(kAlignments, 1);
+            // The window covers all bases the ends may be extended into
+            unsigned int len = fragment.data_len;
+            unsigned int window_begin = o.t_begin -
+                    std::min(o.t_begin, len + ivory::kChainExtension);
+            unsigned int window_end = std::min<std::uint64_t>(
+                    target.data_len,
+                    static_cast<std::uint64_t>(o.t_end) + len +
+                            ivory::kChainExtension);
+            store->Extract(target_id, window_begin, window_end, o.strand,
+                           window);
+            for (auto& it : o.anchors) {
+                it.second = o.strand ? it.second - window_begin :
+                        window_end - it.second - o.kmer_len;
+            }
+            if (!o.strand)
+                std::reverse(o.anchors.begin(), o.anchors.end());
+
+            unsigned int t_begin, t_end;
+            ivory::AlignChain(
+                    fragment.data, len,
+                    window->data(), window->size(),
+                    o.anchors, o.kmer_len,
+                    options.match, options.mismatch, options.gap,
+                    &cigar, &o.q_begin, &o.q_end, &t_begin, &t_end);
+            o.t_begin = o.strand ? window_begin + t_begin : window_end - t_end;
+            o.t_end = o.strand ? window_begin + t_end : window_end - t_begin;
+            if (!o.strand)
+                cigar = ivory::ReverseCigar(cigar);
+        } else if (options.align) {
+            IVORY_TIME(kAlignStage);
+            IVORY_COUNT(kAlignments, 1);
+            store->Extract(target_id, o.t_begin, o.t_end, o.strand, window);
+            ivory::Align(
+                    fragment.data + o.q_begin, o.q_end - o.q_begin,
+                    window->data(), window->size(),
+                    options.type, options.match, options.mismatch,
+                    options.gap, 0, 0,
+                    &cigar);
+            cigar = ivory::StandardCigar(cigar);
+            if (!o.strand)
+                cigar = ivory::ReverseCigar(cigar);
+        }
+
+        IVORY_TIME(kOutputStage);
+        if (options.sam) {
+            ivory::AppendSam(fragment, &target, &o, cigar,
+                             &o != &overlaps.front(), output);
+        } else {
+            ivory::AppendPaf(fragment, target, o, cigar, output);
+        }
+    }
+
+    if (options.sam && overlaps.empty()) {
+        ivory::AppendSam(fragment, nullptr, nullptr, "", false, output);
+    }
+    IVORY_COUNT(kOutputBytes, output->size());
 }
 
-int main(int argc, char **argv) {
-    // std::vector<std::unique_ptr<Sequence>> reference, fragments;
-    // ProcessArgs(argc, argv, &reference, &fragments);
-    // PrintStatistics(reference, 1);
-    // PrintStatistics(fragments, 2);
-    TestMinimizer();
+typedef std::vector<std::vector<std::pair<unsigned int, unsigned int>>>
+        Masks;
+
+// Finds the low complexity intervals of the n sequences in parallel if
+// masking is enabled, and appends them to bed if not null. Returns the
+// number of masked bases.
+std::uint64_t DustSequences(const ivory::SequenceView* sequences,
+                            std::size_t n,
+                            const Options& options,
+                            ivory::ThreadPool* thread_pool,
+                            Masks* masks,
+                            std::ostream* bed) {
+    masks->assign(options.dust_threshold > 0 ? n : 0, Masks::value_type());
+    if (options.dust_threshold == 0)
+        return 0;
+    thread_pool->ParallelFor(n, [&] (std::size_t i, unsigned int) {
+        (*masks)[i] = ivory::Dust(sequences[i].data, sequences[i].data_len,
+                                  options.dust_threshold);
+    });
+
+    std::uint64_t masked_len = 0;
+    for (std::size_t i = 0; i < n; i++) {
+        for (auto& it : (*masks)[i]) {
+            masked_len += it.second - it.first;
+            if (bed != nullptr) {
+                bed->write(sequences[i].name, sequences[i].name_len);
+                *bed << '\t' << it.first << '\t' << it.second << '\n';
+            }
+        }
+    }
+    return masked_len;
+}
+
+// Builds the minimizer index of the sequences, skipping the masked
+// intervals, and the rescue index if enabled. Returns the rescue index for
+// Map, or null if disabled, in which case rescue may be null as well.
+const ivory::RescueIndex* BuildIndex(
+        const std::vector<const char*>& sequences,
+        const std::vector<unsigned int>& sequence_lens,
+        const Masks& masks,
+        const Options& options,
+        ivory::Lookup* lookup,
+        ivory::RescueIndex* rescue) {
+    ivory::Minimize(sequences, sequence_lens, masks,
+                    options.kmer_len, options.window_len, lookup);
+    ivory::Filter(options.frequency, lookup);
+    if (options.rescue_kmer_len == 0)
+        return nullptr;
+
+    rescue->kmer_len = options.rescue_kmer_len;
+    rescue->window_len = options.rescue_window_len;
+    rescue->lookup.clear();
+    ivory::Minimize(sequences, sequence_lens, masks,
+                    rescue->kmer_len, rescue->window_len, &rescue->lookup);
+    ivory::Filter(options.frequency, &rescue->lookup);
+    return rescue;
+}
+
+struct Batch {
+    std::size_t id;
+    std::uint64_t size;  // bytes held by the fragments
+    ivory::SequenceChunk fragments;
+    std::vector<ivory::OutputBuffer> output;
+};
+
+// Opens the i-th fragment input
+typedef std::function<std::unique_ptr<ivory::SequenceReader>(std::size_t)>
+        InputOpener;
+
+// Streams the fragments of num_inputs inputs through a reader thread, the
+// mapping workers and a writer thread which restores the input order of the
+// batches. Parsed batches stay within the memory budget, which may be
+// shared by several streams, until they are written out, so at most one
+// extra batch is held on top of it. Errors of the reader and writer stop the
+// stream and are rethrown once the threads are done, to be sent to the
+// client by ServeConnection or printed by main.
+void MapFragments(const InputOpener& open,
+                  std::size_t num_inputs,
+                  int output_fd,
+                  const ivory::ReferenceStore& reference,
+                  const ivory::Lookup& lookup,
+                  const ivory::RescueIndex* rescue,
+                  const Options& options,
+                  ivory::ThreadPool* thread_pool,
+                  ivory::MemoryBudget* budget,
+                  ivory::LengthStatistics* fragment_stats) {
+    ivory::Channel<std::shared_ptr<Batch>> parsed;
+    // Shared with the callbacks of the workers, the last of which may still
+    // be closing the channel after the writer is done
+    auto mapped = std::make_shared<ivory::Channel<std::shared_ptr<Batch>>>();
+    auto pending = std::make_shared<std::atomic<std::size_t>>(1);
+    std::vector<std::string> windows(thread_pool->num_threads());
+    std::exception_ptr reader_error, writer_error;
+    std::atomic<bool> failed(false);
+
+    std::thread reader([&] () {
+        try {
+            std::size_t id = 0;
+            for (std::size_t i = 0; i < num_inputs && !failed; i++) {
+                std::unique_ptr<ivory::SequenceReader> p = open(i);
+                while (!failed) {
+                    std::shared_ptr<Batch> batch(new Batch());
+                    {
+                        IVORY_TIME(kParseStage);
+                        batch->fragments = p->Parse(options.batch_size);
+                    }
+                    if (batch->fragments.sequences.empty())
+                        break;
+                    batch->id = id++;
+                    batch->size = 0;
+                    for (auto& it : batch->fragments.sequences) {
+                        batch->size += it.name_len + it.data_len +
+                                it.quality_len;
+                        fragment_stats->Add(it.data_len);
+                        IVORY_COUNT(kParsedBases, it.data_len);
+                    }
+                    IVORY_COUNT(kParsedSequences,
+                                batch->fragments.sequences.size());
+                    budget->Acquire(batch->size);
+                    parsed.Push(std::move(batch));
+                }
+            }
+        } catch (...) {
+            reader_error = std::current_exception();
+            failed = true;
+        }
+        parsed.Close();
+    });
+
+    // Once writing fails the batches are only released
+    std::thread writer([&] () {
+        ivory::OutputWriter output(output_fd);
+        try {
+            if (options.sam) {
+                ivory::OutputBuffer header;
+                ivory::AppendSamHeader(reference.views(), VERSION, &header);
+                output.Write(header);
+            }
+        } catch (...) {
+            writer_error = std::current_exception();
+            failed = true;
+        }
+
+        std::map<std::size_t, std::shared_ptr<Batch>> reorder_buffer;
+        std::size_t next_id = 0;
+        std::shared_ptr<Batch> batch;
+        while (mapped->Pop(&batch)) {
+            reorder_buffer[batch->id] = std::move(batch);
+            auto it = reorder_buffer.begin();
+            while (it != reorder_buffer.end() && it->first == next_id) {
+                IVORY_TIME(kOutputStage);
+                try {
+                    for (auto& buffer : it->second->output) {
+                        if (writer_error == nullptr)
+                            output.Write(buffer);
+                    }
+                } catch (...) {
+                    writer_error = std::current_exception();
+                    failed = true;
+                }
+                budget->Release(it->second->size);
+                it = reorder_buffer.erase(it);
+                next_id++;
+            }
+        }
+        try {
+            if (writer_error == nullptr)
+                output.Flush();
+        } catch (...) {
+            writer_error = std::current_exception();
+        }
+    });
+
+    // Batches are mapped concurrently, the last one to finish closes the
+    // channel to the writer
+    std::shared_ptr<Batch> batch;
+    while (parsed.Pop(&batch)) {
+        ++*pending;
+        batch->output.resize(batch->fragments.sequences.size());
+        thread_pool->ParallelForAsync(batch->fragments.sequences.size(),
+                [batch, &reference, &lookup, rescue, &options, &windows]
+                (std::size_t i, unsigned int thread_id) {
+                    MapFragment(batch->fragments.sequences[i],
+                                reference.views(), &reference,
+                                0, UINT_MAX, lookup, rescue, options,
+                                &windows[thread_id], &batch->output[i]);
+                },
+                [batch, mapped, pending] () {
+                    mapped->Push(batch);
+                    if (--*pending == 0)
+                        mapped->Close();
+                });
+    }
+    if (--*pending == 0)
+        mapped->Close();
+
+    reader.join();
+    writer.join();
+    if (reader_error != nullptr)
+        std::rethrow_exception(reader_error);
+    if (writer_error != nullptr)
+        std::rethrow_exception(writer_error);
+}
+
+// Connections served at once, each of which runs a reader, a writer and a
+// decompression thread besides the shared workers
+const unsigned int kMaxConnections = 16;
+
+// Maps the fragments a client sends over the connection and streams the
+// overlaps back, then ends the response and closes the connection. The
+// batches of all connections share the memory budget.
+void ServeConnection(int fd,
+                     const ivory::ReferenceStore& reference,
+                     const ivory::Lookup& lookup,
+                     const ivory::RescueIndex* rescue,
+                     const Options& options,
+                     ivory::ThreadPool* thread_pool,
+                     ivory::MemoryBudget* budget) {
+    auto start = std::chrono::steady_clock::now();
+    ivory::LengthStatistics fragment_stats;
+    std::string error;
+    try {
+        // The reader closes its own descriptor once the request is read
+        MapFragments([fd, thread_pool] (std::size_t) {
+                    int input = dup(fd);
+                    if (input < 0) {
+                        throw std::runtime_error(
+                                "unable to read from the connection");
+                    }
+                    return std::unique_ptr<ivory::SequenceReader>(
+                            new ivory::SequenceReader(input, thread_pool));
+                },
+                1, fd, reference, lookup, rescue, options, thread_pool,
+                budget, &fragment_stats);
+    } catch (const std::exception& e) {
+        error = e.what();
+    }
+    ivory::SendResponseEnd(fd, error);
+    close(fd);
+
+    // Empty requests only probe whether the server is live
+    if (fragment_stats.num_sequences() == 0 && error.empty())
+        return;
+    std::string log = "[ivory_mapper] mapped " +
+            std::to_string(fragment_stats.num_sequences()) + " fragments (" +
+            std::to_string(fragment_stats.total_length()) + " bases) in " +
+            std::to_string(std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - start).count()) + " s" +
+            (error.empty() ? "" : ", " + error) + "\n";
+    std::cerr << log;
+}
+
+// Sends each fragment file to the server over a connection of its own and
+// prints the responses to stdout in order, returns the exit status
+int RequestMapping(const std::vector<std::string>& paths,
+                   const Options& options) {
+    // A server which fails mid-request closes the connection, its error
+    // message is reported instead
+    signal(SIGPIPE, SIG_IGN);
+    ivory::OutputWriter output(STDOUT_FILENO);
+    for (auto& path : paths) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            std::cerr << "Error: Unable to open file " << path << std::endl;
+            return 1;
+        }
+        std::string error;
+        try {
+            int socket = ivory::ConnectUnix(options.connect_path);
+            std::exception_ptr request_error;
+            std::thread sender([&] () {
+                try {
+                    ivory::SendRequest(fd, socket);
+                } catch (...) {
+                    request_error = std::current_exception();
+                }
+            });
+            try {
+                error = ivory::ReceiveResponse(socket, &output);
+            } catch (...) {
+                shutdown(socket, SHUT_RDWR);
+                sender.join();
+                close(socket);
+                throw;
+            }
+            sender.join();
+            close(socket);
+            if (error.empty() && request_error != nullptr)
+                std::rethrow_exception(request_error);
+        } catch (const std::exception& e) {
+            error = e.what();
+        }
+        close(fd);
+        if (!error.empty()) {
+            output.Flush();
+            std::cerr << "Error: " << path << ": " << error << std::endl;
+            return 1;
+        }
+    }
+    output.Flush();
+    return 0;
+}
+
+// Prints the length statistics of each file to stdout. Files are streamed
+// in parallel, each holding one batch at a time, and BGZF files are
+// decompressed by all threads if there is only one file.
+void PrintFileStatistics(const std::vector<std::string>& paths,
+                         const Options& options,
+                         ivory::ThreadPool* thread_pool) {
+    std::vector<ivory::LengthStatistics> stats(paths.size());
+    std::vector<std::exception_ptr> errors(paths.size());
+    auto read = [&] (std::size_t i, ivory::ThreadPool* inflate_pool) {
+        try {
+            ivory::SequenceReader reader(paths[i], inflate_pool);
+            while (true) {
+                ivory::SequenceChunk chunk = reader.Parse(options.batch_size);
+                if (chunk.sequences.empty())
+                    break;
+                for (auto& it : chunk.sequences)
+                    stats[i].Add(it.data_len);
+            }
+        } catch (...) {
+            errors[i] = std::current_exception();
+        }
+    };
+    // A single file is read by the caller and inflated by the pool, while
+    // files read by the workers are inflated on their own background threads
+    if (paths.size() == 1) {
+        read(0, thread_pool);
+    } else {
+        thread_pool->ParallelFor(paths.size(),
+                [&] (std::size_t i, unsigned int) { read(i, nullptr); });
+    }
+    for (auto& it : errors) {
+        if (it != nullptr)
+            std::rethrow_exception(it);
+    }
+
+    ivory::LengthStatistics total;
+    for (std::size_t i = 0; i < paths.size(); i++) {
+        PrintStatistics(stats[i], paths[i], options.genome_size, std::cout);
+        total.Merge(stats[i]);
+    }
+    if (paths.size() > 1)
+        PrintStatistics(total, "Total", options.genome_size, std::cout);
+}
+
+// Overlaps the fragments with each other. Each unordered pair is computed
+// once, as every fragment is queried only against fragments with a lower
+// id, and the index holds at most index_size bases of fragments at a time.
+void MapAllVsAll(const std::vector<std::string>& paths,
+                 const Options& options,
+                 ivory::ThreadPool* thread_pool,
+                 std::ostream* bed,
+                 ivory::LengthStatistics* fragment_stats) {
+    std::vector<ivory::SequenceChunk> chunks;
+    std::vector<ivory::SequenceView> fragments;
+    for (auto& path : paths) {
+        IVORY_TIME(kParseStage);
+        ivory::SequenceReader reader(path, thread_pool);
+        chunks.emplace_back(reader.ParseAll(thread_pool));
+        fragments.insert(fragments.end(), chunks.back().sequences.begin(),
+                         chunks.back().sequences.end());
+    }
+
+    // The fragments stay in memory as parsed, and are packed once more only
+    // if target windows are extracted for alignment
+    ivory::ReferenceStore store;
+    for (auto& it : fragments) {
+        fragment_stats->Add(it.data_len);
+        if (options.align)
+            store.Add(it);
+        IVORY_COUNT(kParsedBases, it.data_len);
+    }
+    IVORY_COUNT(kParsedSequences, fragments.size());
+    PrintStatistics(*fragment_stats, "Fragments Statistics",
+                    options.genome_size, std::cerr);
+
+    const std::size_t kQueryBatchSize = 1 << 16;
+    ivory::OutputWriter output(STDOUT_FILENO);
+    std::vector<ivory::OutputBuffer> buffers;
+    std::vector<std::string> windows(thread_pool->num_threads());
+
+    for (std::size_t begin = 0, end; begin < fragments.size(); begin = end) {
+        std::vector<const char*> sequences;
+        std::vector<unsigned int> sequence_lens;
+        std::uint64_t index_size = 0;
+        for (end = begin; end < fragments.size() &&
+                (end == begin || index_size < options.index_size); end++) {
+            sequences.push_back(fragments[end].data);
+            sequence_lens.push_back(fragments[end].data_len);
+            index_size += fragments[end].data_len;
+        }
+
+        Masks masks;
+        DustSequences(&fragments[begin], end - begin, options, thread_pool,
+                      &masks, bed);
+        ivory::Lookup lookup;
+        BuildIndex(sequences, sequence_lens, masks, options, &lookup, nullptr);
+
+        // Only fragments after the first indexed one have lower id targets
+        for (std::size_t query_begin = begin + 1, query_end;
+                query_begin < fragments.size(); query_begin = query_end) {
+            query_end = std::min(fragments.size(),
+                                 query_begin + kQueryBatchSize);
+            buffers.assign(query_end - query_begin, ivory::OutputBuffer());
+            thread_pool->ParallelFor(query_end - query_begin,
+                    [&] (std::size_t i, unsigned int thread_id) {
+                        std::size_t id = query_begin + i;
+                        MapFragment(fragments[id], fragments, &store, begin,
+                                    std::min(id, end) - begin,
+                                    lookup, nullptr, options,
+                                    &windows[thread_id],
+                                    &buffers[i]);
+                    });
+            for (auto& it : buffers)
+                output.Write(it);
+        }
+    }
+    output.Flush();
+}
+
+// Runs the mode selected by the options, returns the exit status. Errors of
+// the inputs and of the pipeline are thrown to main.
+int Run(const Options& options,
+        const std::string& reference_path,
+        const std::vector<std::string>& fragment_paths) {
+    if (!options.connect_path.empty())
+        return RequestMapping(fragment_paths, options);
+
+    auto start = std::chrono::steady_clock::now();
+    auto elapsed = [&start] () {
+        return std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - start).count();
+    };
+
+    // The report is opened before the run, so an unwritable path is not
+    // found out only at its end
+    std::unique_ptr<std::ofstream> report;
+    if (!options.report_path.empty()) {
+        report.reset(new std::ofstream(options.report_path));
+        if (!*report) {
+            std::cerr << "Error: Unable to write report "
+                      << options.report_path << std::endl;
+            return 1;
+        }
+    }
+
+    ivory::ThreadPool thread_pool(options.num_threads);
+    if (options.stats_only) {
+        PrintFileStatistics(fragment_paths, options, &thread_pool);
+        if (report != nullptr) {
+            WriteReport(*report, options, elapsed(),
+                        nullptr, nullptr);
+        }
+        return 0;
+    }
+    std::unique_ptr<std::ofstream> bed;
+    if (!options.dust_bed_path.empty()) {
+        bed.reset(new std::ofstream(options.dust_bed_path));
+        if (!*bed) {
+            std::cerr << "Error: Unable to write " << options.dust_bed_path
+                      << std::endl;
+            return 1;
+        }
+    }
+
+    if (options.ava) {
+        ivory::LengthStatistics fragment_stats;
+        MapAllVsAll(fragment_paths, options, &thread_pool, bed.get(),
+                    &fragment_stats);
+        if (report != nullptr) {
+            WriteReport(*report, options, elapsed(),
+                        nullptr, &fragment_stats);
+        }
+        return 0;
+    }
+
+    // The socket is taken before the index is built, so clients wait in its
+    // backlog until the server is ready
+    std::unique_ptr<ivory::UnixServer> server;
+    if (!options.serve_path.empty()) {
+        server.reset(new ivory::UnixServer(options.serve_path));
+        server->InstallSignalHandlers();
+    }
+
+    // The parsed reference is released once indexed, only its packed copy
+    // is kept for alignment
+    ivory::Lookup lookup;
+    ivory::RescueIndex rescue_index;
+    const ivory::RescueIndex* rescue = nullptr;
+    ivory::ReferenceStore reference;
+    ivory::LengthStatistics reference_stats;
+    {
+        ivory::SequenceChunk chunk;
+        {
+            IVORY_TIME(kParseStage);
+            ivory::SequenceReader reader(reference_path, &thread_pool);
+            chunk = reader.ParseAll(&thread_pool);
+        }
+
+        std::vector<const char*> sequences;
+        std::vector<unsigned int> sequence_lens;
+        for (auto& it : chunk.sequences) {
+            sequences.push_back(it.data);
+            sequence_lens.push_back(it.data_len);
+            reference.Add(it);
+            reference_stats.Add(it.data_len);
+        }
+        PrintStatistics(reference_stats, "Reference Statistics",
+                        options.genome_size, std::cerr);
+
+        Masks masks;
+        std::uint64_t masked_len = DustSequences(
+                chunk.sequences.data(), chunk.sequences.size(), options,
+                &thread_pool, &masks, bed.get());
+        if (options.dust_threshold > 0)
+            std::cerr << "Masked length\t\t=\t" << masked_len << std::endl;
+
+        rescue = BuildIndex(sequences, sequence_lens, masks, options,
+                            &lookup, &rescue_index);
+    }
+
+    // The lookup table is only read from here on, so the workers share it
+    // without locking
+    ivory::MemoryBudget budget(options.max_memory);
+    if (server != nullptr) {
+        std::cerr << "[ivory_mapper] listening on " << options.serve_path
+                  << std::endl;
+        server->Serve([&] (int fd) {
+            ServeConnection(fd, reference, lookup, rescue, options,
+                            &thread_pool, &budget);
+        }, kMaxConnections);
+        std::cerr << "[ivory_mapper] stopped" << std::endl;
+        return 0;
+    }
+
+    ivory::LengthStatistics fragment_stats;
+    MapFragments([&fragment_paths, &thread_pool] (std::size_t i) {
+                return std::unique_ptr<ivory::SequenceReader>(
+                        new ivory::SequenceReader(fragment_paths[i],
+                                                  &thread_pool));
+            },
+            fragment_paths.size(), STDOUT_FILENO, reference, lookup, rescue,
+            options, &thread_pool, &budget, &fragment_stats);
+    PrintStatistics(fragment_stats, "Fragments Statistics",
+                    options.genome_size > 0 ?
+                            options.genome_size : reference_stats.total_length(),
+                    std::cerr);
+    if (report != nullptr) {
+        WriteReport(*report, options, elapsed(),
+                    &reference_stats, &fragment_stats);
+    }
+
     return 0;
 }
+
+int main(int argc, char **argv) {
+    Options options;
+    std::string reference_path;
+    std::vector<std::string> fragment_paths;
+    ProcessArgs(argc, argv, &options, &reference_path, &fragment_paths);
+
+    // Missing or unreadable files and malformed records are reported like
+    // invalid arguments, rather than terminating the program
+    try {
+        return Run(options, reference_path, fragment_paths);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -1,6 +1,37 @@
 // Copyright (c) 2021 Lovro Vrcek
 
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <climits>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
 #include "aligner.hpp"
+#include "dust.hpp"
+#include "evaluation.hpp"
+#include "minimizer.hpp"
+#include "output.hpp"
+#include "pipeline.hpp"
+#include "profile.hpp"
+#include "reader.hpp"
+#include "reference.hpp"
+#include "server.hpp"
+#include "statistics.hpp"
+#include "thread_pool.hpp"
 
 #include "bioparser/fasta_parser.hpp"
 #include "bioparser/fastq_parser.hpp"
@@ -101,3 +132,966 @@ TEST(AlignerTest, SemiGlobalAlignmentAffine) {
     EXPECT_EQ(cigar, "4M");
     EXPECT_EQ(target_begin, 4);
 }
+
+std::string RandomSequence(unsigned int len, unsigned int seed) {
+    std::mt19937 generator(seed);
+    std::string s(len, 'A');
+    for (auto& c : s)
+        c = "ACGT"[generator() % 4];
+    return s;
+}
+
+// Test chain guided alignment with a mismatch and a gap between anchors
+TEST(AlignerTest, ChainAlignment) {
+    std::string target = RandomSequence(200, 3);
+    std::string query = target.substr(20, 80) + target.substr(101, 79);
+    query[50] = query[50] == 'A' ? 'C' : 'A';
+    std::vector<std::pair<unsigned int, unsigned int>> anchors = {
+        {0, 20}, {60, 80}, {100, 121}, {140, 161}};
+
+    std::string cigar;
+    unsigned int q_begin, q_end, t_begin, t_end;
+    int score = ivory::AlignChain(
+            query.c_str(), query.size(), target.c_str(), target.size(),
+            anchors, 10, 3, -5, -4,
+            &cigar, &q_begin, &q_end, &t_begin, &t_end);
+
+    EXPECT_EQ(score, 158 * 3 - 5 - 4);
+    EXPECT_EQ(cigar, "79M1D80M");
+    EXPECT_EQ(q_begin, 0);
+    EXPECT_EQ(q_end, 159);
+    EXPECT_EQ(t_begin, 20);
+    EXPECT_EQ(t_end, 180);
+}
+
+// Test that chain guided alignment extends the ends beyond the anchors
+TEST(AlignerTest, ChainAlignmentExtension) {
+    std::string target = RandomSequence(300, 5);
+    std::string query = RandomSequence(30, 6) + target.substr(100, 100);
+    std::vector<std::pair<unsigned int, unsigned int>> anchors = {
+        {60, 130}, {90, 160}};
+
+    std::string cigar;
+    unsigned int q_begin, q_end, t_begin, t_end;
+    int score = ivory::AlignChain(
+            query.c_str(), query.size(), target.c_str(), target.size(),
+            anchors, 15, 3, -5, -4,
+            &cigar, &q_begin, &q_end, &t_begin, &t_end);
+
+    EXPECT_EQ(q_end, 130);
+    EXPECT_EQ(t_end, 200);
+    EXPECT_LE(q_begin, 30);
+    EXPECT_LE(t_begin, 100);
+    EXPECT_GE(score, 100 * 3);
+}
+
+// Test reversing the order of CIGAR operations
+TEST(AlignerTest, ReverseCigar) {
+    EXPECT_EQ(ivory::ReverseCigar("12M1I3M2D"), "2D3M1I12M");
+    EXPECT_EQ(ivory::ReverseCigar("100M"), "100M");
+    EXPECT_EQ(ivory::ReverseCigar(""), "");
+}
+
+// Test swapping the insertions and deletions of Align into the SAM convention
+TEST(AlignerTest, StandardCigar) {
+    EXPECT_EQ(ivory::StandardCigar("1M1I1M1D4M"), "1M1D1M1I4M");
+    EXPECT_EQ(ivory::StandardCigar("100M"), "100M");
+}
+
+// Test minimizers of a single sequence
+TEST(MinimizerTest, MinimizeSequence) {
+    auto minimizers = ivory::Minimize("AAGCTCGGTAC", 11, 3, 3);
+
+    // CAGT -> 0123, e.g. 'AAG' is 22 and its reverse complement 'CTT' is 15
+    ASSERT_EQ(minimizers.size(), 5);
+    EXPECT_EQ(minimizers[0], std::make_tuple(15U, 0U, false));
+    EXPECT_EQ(minimizers[1], std::make_tuple(12U, 3U, true));
+    EXPECT_EQ(minimizers[2], std::make_tuple(9U, 4U, false));
+    EXPECT_EQ(minimizers[3], std::make_tuple(2U, 5U, false));
+    EXPECT_EQ(minimizers[4], std::make_tuple(16U, 6U, false));
+}
+
+// Test that both strands of a sequence share their minimizers
+TEST(MinimizerTest, MinimizeReverseComplement) {
+    std::string s = "ACGTTGCAAGGCTTACCGATAGCTAAGCTT";
+    std::string rc = ivory::ReverseComplement(s);
+    EXPECT_EQ(rc, "AAGCTTAGCTATCGGTAAGCCTTGCAACGT");
+
+    std::set<unsigned int> m, m_rc;
+    for (auto& it : ivory::Minimize(s.c_str(), s.size(), 5, 4))
+        m.insert(std::get<0>(it));
+    for (auto& it : ivory::Minimize(rc.c_str(), rc.size(), 5, 4))
+        m_rc.insert(std::get<0>(it));
+    EXPECT_EQ(m, m_rc);
+}
+
+// Test that the shortest sequences still get a minimizer
+TEST(MinimizerTest, MinimizeShortSequence) {
+    EXPECT_EQ(ivory::Minimize("GATTA", 5, 3, 10).size(), 1);
+    EXPECT_TRUE(ivory::Minimize("GA", 2, 3, 10).empty());
+    EXPECT_THROW(ivory::Minimize("GATTA", 5, 17, 10), std::invalid_argument);
+}
+
+// Test that low quality bases break k-mers like N does, as do the bases
+// past a shorter quality
+TEST(MinimizerTest, MinimizeQualityMask) {
+    std::string sequence = "GATTACAGATTACATTTAGGCCAGTACGATCCA";
+    std::string quality(sequence.size(), 'I');
+    quality[12] = '#';
+    std::string masked = sequence;
+    masked[12] = 'N';
+    EXPECT_EQ(ivory::Minimize(sequence.c_str(), sequence.size(),
+                              quality.c_str(), quality.size(), 10, 5, 3),
+              ivory::Minimize(masked.c_str(), masked.size(), 5, 3));
+    EXPECT_EQ(ivory::Minimize(sequence.c_str(), sequence.size(),
+                              quality.c_str(), quality.size(), 2, 5, 3),
+              ivory::Minimize(sequence.c_str(), sequence.size(), 5, 3));
+    EXPECT_EQ(ivory::Minimize(sequence.c_str(), sequence.size(),
+                              nullptr, 0, 10, 5, 3),
+              ivory::Minimize(sequence.c_str(), sequence.size(), 5, 3));
+    EXPECT_EQ(ivory::Minimize(sequence.c_str(), sequence.size(),
+                              quality.c_str(), 20, 2, 5, 3),
+              ivory::Minimize(sequence.c_str(), 20, 5, 3));
+}
+
+// Test the lookup table and frequency filter
+TEST(MinimizerTest, LookupAndFilter) {
+    std::vector<const char*> sequences = {"AAGCTCGGTAC", "CCAAGCAAGTTTG"};
+    std::vector<unsigned int> sequence_lens = {11, 13};
+    ivory::Lookup lookup;
+    ivory::Minimize(sequences, sequence_lens, 3, 3, &lookup);
+
+    ASSERT_EQ(lookup.size(), 8);
+    ASSERT_EQ(lookup.count(15), 1);
+    ASSERT_EQ(lookup[15].size(), 3);
+    EXPECT_EQ(lookup[15][0], std::make_tuple(0U, false, 0U));
+    EXPECT_EQ(lookup[15][1], std::make_tuple(1U, false, 2U));
+
+    ivory::Filter(0.25, &lookup);
+    EXPECT_EQ(lookup.size(), 6);
+    EXPECT_EQ(lookup.count(15), 0);
+    EXPECT_EQ(lookup.count(5), 0);
+}
+
+// Test that masked intervals drop only the minimizers overlapping them
+TEST(MinimizerTest, LookupMask) {
+    std::vector<const char*> sequences = {"AAGCTCGGTAC", "CCAAGCAAGTTTG"};
+    std::vector<unsigned int> sequence_lens = {11, 13};
+    ivory::Lookup lookup, masked_lookup;
+    ivory::Minimize(sequences, sequence_lens, 3, 3, &lookup);
+    ivory::Minimize(sequences, sequence_lens, {{{2, 3}}, {}}, 3, 3,
+                    &masked_lookup);
+
+    // Only the minimizers of the first sequence overlapping base 2 are gone
+    std::size_t num_minimizers = 0, num_masked_minimizers = 0;
+    for (auto& it : lookup) {
+        for (auto& t : it.second) {
+            unsigned int pos = std::get<2>(t);
+            bool masked = std::get<0>(t) == 0 && pos <= 2 && pos + 3 > 2;
+            num_masked_minimizers += masked;
+            num_minimizers++;
+            auto& bucket = masked_lookup[it.first];
+            EXPECT_EQ(std::count(bucket.begin(), bucket.end(), t),
+                      masked ? 0 : 1);
+        }
+    }
+    std::size_t num_remaining = 0;
+    for (auto& it : masked_lookup)
+        num_remaining += it.second.size();
+    EXPECT_GT(num_masked_minimizers, 0);
+    EXPECT_EQ(num_remaining, num_minimizers - num_masked_minimizers);
+}
+
+// Test mapping of fragments on both strands
+TEST(MinimizerTest, MapFragments) {
+    std::string reference = RandomSequence(20000, 42);
+    std::vector<const char*> sequences = {reference.c_str()};
+    std::vector<unsigned int> sequence_lens = {20000};
+    ivory::Lookup lookup;
+    ivory::Minimize(sequences, sequence_lens, 15, 10, &lookup);
+
+    std::string fragment = reference.substr(5000, 2000);
+    fragment[700] = fragment[700] == 'A' ? 'C' : 'A';
+    auto overlaps = ivory::Map(fragment.c_str(), fragment.size(), lookup, 15,
+                               10);
+    ASSERT_FALSE(overlaps.empty());
+    EXPECT_TRUE(overlaps[0].strand);
+    EXPECT_EQ(overlaps[0].t_begin, 5000 + overlaps[0].q_begin);
+    EXPECT_NEAR(overlaps[0].t_end, 7000, 20);
+    EXPECT_NEAR(overlaps[0].q_end - overlaps[0].q_begin, 2000, 20);
+
+    std::string rc = ivory::ReverseComplement(fragment);
+    overlaps = ivory::Map(rc.c_str(), rc.size(), lookup, 15, 10);
+    ASSERT_FALSE(overlaps.empty());
+    EXPECT_FALSE(overlaps[0].strand);
+    EXPECT_NEAR(overlaps[0].t_begin, 5000, 20);
+    EXPECT_NEAR(overlaps[0].t_end, 7000, 20);
+
+    std::string unrelated = RandomSequence(2000, 7);
+    EXPECT_TRUE(ivory::Map(unrelated.c_str(), 2000, lookup, 15, 10).empty());
+}
+
+// Test that only targets with a lower id are chained
+TEST(MinimizerTest, MapTargetLimit) {
+    std::string read = RandomSequence(3000, 11);
+    std::string other = RandomSequence(3000, 12);
+    std::vector<const char*> sequences = {other.c_str(), read.c_str()};
+    std::vector<unsigned int> sequence_lens = {3000, 3000};
+    ivory::Lookup lookup;
+    ivory::Minimize(sequences, sequence_lens, 15, 10, &lookup);
+
+    auto overlaps = ivory::Map(read.c_str(), 3000, lookup, 15, 10);
+    ASSERT_EQ(overlaps.size(), 1);
+    EXPECT_EQ(overlaps[0].target_id, 1);
+    EXPECT_TRUE(ivory::Map(read.c_str(), 3000, lookup, 15, 10, 1).empty());
+}
+
+// Test that only reads the main index fails to chain are seeded again with
+// the denser rescue index
+TEST(MinimizerTest, MapRescue) {
+    std::string target = RandomSequence(3000, 13);
+    std::vector<const char*> sequences = {target.c_str()};
+    std::vector<unsigned int> sequence_lens = {3000};
+    ivory::Lookup lookup;
+    ivory::Minimize(sequences, sequence_lens, 15, 10, &lookup);
+    ivory::RescueIndex rescue;
+    rescue.kmer_len = 7;
+    rescue.window_len = 1;
+    ivory::Minimize(sequences, sequence_lens, 7, 1, &rescue.lookup);
+
+    // Every 15-mer of the divergent read has a substitution
+    std::string divergent = target;
+    for (std::size_t i = 0; i < divergent.size(); i += 8)
+        divergent[i] = divergent[i] == 'A' ? 'C' : 'A';
+    EXPECT_TRUE(ivory::Map(divergent.c_str(), 3000, lookup, 15, 10).empty());
+    auto overlaps = ivory::Map(divergent.c_str(), 3000, lookup, 15, 10,
+                               UINT_MAX, nullptr, 0, 0, &rescue);
+    ASSERT_FALSE(overlaps.empty());
+    EXPECT_EQ(overlaps[0].kmer_len, 7);
+    EXPECT_TRUE(overlaps[0].strand);
+    EXPECT_LT(overlaps[0].t_begin, 100);
+    EXPECT_GT(overlaps[0].t_end, 2900);
+
+    overlaps = ivory::Map(target.c_str(), 3000, lookup, 15, 10,
+                          UINT_MAX, nullptr, 0, 0, &rescue);
+    ASSERT_EQ(overlaps.size(), 1);
+    EXPECT_EQ(overlaps[0].kmer_len, 15);
+}
+
+// Test that every task of the thread pool is run exactly once
+TEST(ThreadPoolTest, ParallelFor) {
+    ivory::ThreadPool thread_pool(4);
+    EXPECT_EQ(thread_pool.num_threads(), 4);
+    EXPECT_EQ(thread_pool.ThreadId(), -1);
+
+    std::vector<std::atomic<int>> visits(10007);
+    for (auto& it : visits)
+        it = 0;
+    thread_pool.ParallelFor(visits.size(),
+            [&visits] (std::size_t i, unsigned int thread_id) {
+                EXPECT_LT(thread_id, 4);
+                visits[i]++;
+            });
+    for (auto& it : visits)
+        EXPECT_EQ(it, 1);
+
+    auto future = thread_pool.Submit([] (int a, int b) { return a + b; }, 2, 3);
+    EXPECT_EQ(future.get(), 5);
+}
+
+// Test that the last batch of an asynchronous loop reports completion
+TEST(ThreadPoolTest, ParallelForAsync) {
+    ivory::ThreadPool thread_pool(3);
+    ivory::Channel<int> done;
+    std::atomic<int> sum(0);
+    thread_pool.ParallelForAsync(100,
+            [&sum] (std::size_t i, unsigned int) { sum += i; },
+            [&done, &sum] () { done.Push(sum); });
+
+    int result = 0;
+    ASSERT_TRUE(done.Pop(&result));
+    EXPECT_EQ(result, 4950);
+}
+
+// Test that a closed channel is drained before it stops
+TEST(PipelineTest, Channel) {
+    ivory::Channel<int> channel;
+    std::thread producer([&channel] () {
+        for (int i = 0; i < 1000; i++)
+            channel.Push(i);
+        channel.Close();
+    });
+
+    int item = 0, expected = 0;
+    while (channel.Pop(&item))
+        EXPECT_EQ(item, expected++);
+    EXPECT_EQ(expected, 1000);
+    producer.join();
+}
+
+// Test that a full channel blocks the producer until an item is taken
+TEST(PipelineTest, BoundedChannel) {
+    ivory::Channel<int> channel(1);
+    std::atomic<int> pushed(0);
+    std::thread producer([&channel, &pushed] () {
+        for (int i = 0; i < 3; i++) {
+            channel.Push(i);
+            pushed++;
+        }
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_EQ(pushed, 1);
+    int item = -1;
+    ASSERT_TRUE(channel.Pop(&item));
+    EXPECT_EQ(item, 0);
+    ASSERT_TRUE(channel.Pop(&item));
+    EXPECT_EQ(item, 1);
+    producer.join();
+    channel.Close();
+    EXPECT_FALSE(channel.Push(3));
+    ASSERT_TRUE(channel.Pop(&item));
+    EXPECT_EQ(item, 2);
+    EXPECT_FALSE(channel.Pop(&item));
+}
+
+// Test that the memory budget blocks until enough bytes are released
+TEST(PipelineTest, MemoryBudget) {
+    ivory::MemoryBudget budget(100);
+    budget.Acquire(60);
+    budget.Acquire(40);
+
+    std::atomic<bool> acquired(false);
+    std::thread consumer([&budget, &acquired] () {
+        budget.Acquire(30);
+        acquired = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_FALSE(acquired);
+    budget.Release(60);
+    consumer.join();
+    EXPECT_TRUE(acquired);
+
+    // Requests over the limit pass once the budget is empty
+    budget.Release(70);
+    budget.Acquire(1000);
+    budget.Release(1000);
+}
+
+// Test integer formatting of the output buffer
+TEST(OutputTest, AppendInteger) {
+    ivory::OutputBuffer buffer;
+    buffer.AppendInteger(0);
+    buffer.Append(' ');
+    buffer.AppendInteger(4294967295U);
+    buffer.Append(' ');
+    buffer.AppendInteger(-42);
+    buffer.Append(' ');
+    buffer.AppendInteger(LLONG_MIN);
+    EXPECT_EQ(buffer.data(), "0 4294967295 -42 -9223372036854775808");
+}
+
+ivory::Overlap TestOverlap() {
+    ivory::Overlap o;
+    o.target_id = 0;
+    o.strand = false;
+    o.q_begin = 2;
+    o.q_end = 9;
+    o.t_begin = 100;
+    o.t_end = 106;
+    o.matches = 5;
+    o.num_anchors = 1;
+    return o;
+}
+
+// Test PAF and SAM lines of an overlap on the opposite strand
+TEST(OutputTest, PafAndSam) {
+    ivory::Overlap o = TestOverlap();
+    ivory::SequenceView read = {"read", 4, "AACCGGTTAC", 10, "0123456789", 10};
+    ivory::SequenceView chr = {"chr", 3, nullptr, 1000, nullptr, 0};
+    ivory::OutputBuffer paf;
+    ivory::AppendPaf(read, chr, o, "3M1I3M", &paf);
+    EXPECT_EQ(paf.data(),
+              "read\t10\t2\t9\t-\tchr\t1000\t100\t106\t5\t7\t255"
+              "\tcg:Z:3M1I3M\n");
+
+    ivory::OutputBuffer sam;
+    ivory::AppendSam(read, &chr, &o, "3M1I3M", false, &sam);
+    ivory::AppendSam(read, &chr, &o, "3M1I3M", true, &sam);
+    read.quality = nullptr;
+    read.quality_len = 0;
+    ivory::AppendSam(read, nullptr, nullptr, "", false, &sam);
+    EXPECT_EQ(sam.data(),
+              "read\t16\tchr\t101\t255\t1S3M1I3M2S\t*\t0\t0\t"
+              "GTAACCGGTT\t9876543210\n"
+              "read\t272\tchr\t101\t255\t1S3M1I3M2S\t*\t0\t0\t*\t*\n"
+              "read\t4\t*\t0\t0\t*\t*\t0\t0\tAACCGGTTAC\t*\n");
+}
+
+// Test that buffered output reaches the file descriptor in order
+TEST(OutputTest, Writer) {
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    {
+        ivory::OutputWriter writer(fds[1], 8);
+        writer.Write("abc", 3);
+        writer.Write("defgh", 5);
+        writer.Write("0123456789", 10);
+        writer.Write("xy", 2);
+    }
+    close(fds[1]);
+
+    char data[64];
+    std::string result;
+    ssize_t n;
+    while ((n = read(fds[0], data, sizeof(data))) > 0)
+        result.append(data, n);
+    close(fds[0]);
+    EXPECT_EQ(result, "abcdefgh0123456789xy");
+}
+
+std::string TemporaryFile(const std::string& content, bool compressed) {
+    char path[] = "/tmp/ivory_reader_XXXXXX";
+    int fd = mkstemp(path);
+    if (compressed) {
+        gzFile file = gzdopen(fd, "w");
+        gzwrite(file, content.data(), content.size());
+        gzclose(file);
+    } else {
+        EXPECT_EQ(write(fd, content.data(), content.size()),
+                  static_cast<ssize_t>(content.size()));
+        close(fd);
+    }
+    return path;
+}
+
+std::vector<std::string> Names(const ivory::SequenceChunk& chunk) {
+    std::vector<std::string> names;
+    for (auto& it : chunk.sequences)
+        names.emplace_back(it.name, it.name_len);
+    return names;
+}
+
+// Test FASTA records spanning one or more lines, read in small chunks
+TEST(ReaderTest, Fasta) {
+    std::string path = TemporaryFile(
+            ">a first\nACGT\n>b\r\nAC\r\nGT\r\nTT\r\n\n>c\nGGG", false);
+    ivory::SequenceReader reader(path);
+    EXPECT_TRUE(reader.is_mapped());
+    EXPECT_FALSE(reader.is_fastq());
+
+    std::vector<ivory::SequenceChunk> chunks;
+    while (true) {
+        chunks.emplace_back(reader.Parse(1));
+        if (chunks.back().sequences.empty())
+            break;
+    }
+    ASSERT_EQ(chunks.size(), 4);
+    const ivory::SequenceView& a = chunks[0].sequences.front();
+    const ivory::SequenceView& b = chunks[1].sequences.front();
+    const ivory::SequenceView& c = chunks[2].sequences.front();
+    EXPECT_EQ(std::string(a.name, a.name_len), "a");
+    EXPECT_EQ(std::string(a.data, a.data_len), "ACGT");
+    EXPECT_EQ(std::string(b.name, b.name_len), "b");
+    EXPECT_EQ(std::string(b.data, b.data_len), "ACGTTT");
+    EXPECT_EQ(std::string(c.data, c.data_len), "GGG");
+    EXPECT_EQ(c.quality, nullptr);
+    unlink(path.c_str());
+}
+
+// Test compressed FASTQ input spanning several decompressed blocks, where a
+// quality line may start with '@'
+TEST(ReaderTest, FastqGzip) {
+    std::string content;
+    for (int i = 0; i < 100000; i++)
+        content += "@r" + std::to_string(i) + "\nACGTA\n+\n@@III\n";
+    std::string path = TemporaryFile(content, true);
+    ivory::SequenceReader reader(path);
+    EXPECT_FALSE(reader.is_mapped());
+    EXPECT_TRUE(reader.is_fastq());
+
+    std::vector<std::string> names;
+    while (true) {
+        ivory::SequenceChunk chunk = reader.Parse(1500000);
+        if (chunk.sequences.empty())
+            break;
+        for (auto& it : chunk.sequences) {
+            EXPECT_EQ(std::string(it.data, it.data_len), "ACGTA");
+            EXPECT_EQ(std::string(it.quality, it.quality_len), "@@III");
+        }
+        std::vector<std::string> n = Names(chunk);
+        names.insert(names.end(), n.begin(), n.end());
+    }
+    ASSERT_EQ(names.size(), 100000);
+    EXPECT_EQ(names[54321], "r54321");
+    EXPECT_EQ(names.back(), "r99999");
+    unlink(path.c_str());
+}
+
+// Test that FASTQ records whose quality line differs in length from the
+// sequence are rejected
+TEST(ReaderTest, FastqQualityLength) {
+    std::string path = TemporaryFile("@a\nACGT\n+\nIIII\n@b\nACGT\n+\nII\n",
+                                     false);
+    ivory::SequenceReader reader(path);
+    EXPECT_THROW(reader.Parse(1 << 20), std::runtime_error);
+    unlink(path.c_str());
+}
+
+// Compresses data into a single BGZF block
+std::string BgzfBlock(const std::string& data) {
+    z_stream stream = {};
+    deflateInit2(&stream, 6, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+    unsigned char extra[6] = {'B', 'C', 2, 0, 0, 0};
+    gz_header header = {};
+    header.extra = extra;
+    header.extra_len = 6;
+    deflateSetHeader(&stream, &header);
+    std::string block(deflateBound(&stream, data.size()) + 64, '\0');
+    stream.next_in = reinterpret_cast<unsigned char*>(
+            const_cast<char*>(data.data()));
+    stream.avail_in = data.size();
+    stream.next_out = reinterpret_cast<unsigned char*>(&block[0]);
+    stream.avail_out = block.size();
+    deflate(&stream, Z_FINISH);
+    block.resize(stream.total_out);
+    deflateEnd(&stream);
+    block[16] = (block.size() - 1) & 0xff;
+    block[17] = (block.size() - 1) >> 8;
+    return block;
+}
+
+// Test BGZF input inflated by several threads, blocks split records
+TEST(ReaderTest, Bgzf) {
+    std::string content;
+    for (int i = 0; i < 20000; i++)
+        content += ">r" + std::to_string(i) + "\n" + RandomSequence(20, i) + "\n";
+    std::string compressed;
+    for (std::size_t i = 0; i < content.size(); i += 60000)
+        compressed += BgzfBlock(content.substr(i, 60000));
+    compressed += BgzfBlock("");
+
+    char path[] = "/tmp/ivory_reader_XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_EQ(write(fd, compressed.data(), compressed.size()),
+              static_cast<ssize_t>(compressed.size()));
+    close(fd);
+
+    ivory::ThreadPool thread_pool(4);
+    ivory::SequenceReader reader(path, &thread_pool);
+    EXPECT_FALSE(reader.is_mapped());
+    std::vector<std::string> names;
+    while (true) {
+        ivory::SequenceChunk chunk = reader.Parse(100000);
+        if (chunk.sequences.empty())
+            break;
+        for (auto& it : chunk.sequences)
+            EXPECT_EQ(it.data_len, 20);
+        std::vector<std::string> n = Names(chunk);
+        names.insert(names.end(), n.begin(), n.end());
+    }
+    ASSERT_EQ(names.size(), 20000);
+    EXPECT_EQ(names[12345], "r12345");
+    unlink(path);
+
+    // A truncated block is reported instead of ending the input early
+    std::string truncated = TemporaryFile(
+            compressed.substr(0, compressed.size() / 2), false);
+    EXPECT_THROW({
+        ivory::SequenceReader broken(truncated);
+        while (!broken.Parse(100000).sequences.empty()) {}
+    }, std::runtime_error);
+    unlink(truncated.c_str());
+
+    // So is an uncompressed size above the BGZF limit
+    std::string block = BgzfBlock(content.substr(0, 60000));
+    block.replace(block.size() - 4, 4, "\xff\xff\xff\x7f");
+    std::string oversized = TemporaryFile(block + BgzfBlock(""), false);
+    EXPECT_THROW({
+        ivory::SequenceReader broken(oversized, &thread_pool);
+        while (!broken.Parse(100000).sequences.empty()) {}
+    }, std::runtime_error);
+    unlink(oversized.c_str());
+}
+
+// Test that a file split among threads yields the records in order
+TEST(ReaderTest, ParseAll) {
+    std::vector<std::string> expected;
+    std::string fasta, fastq;
+    for (int i = 0; i < 500; i++) {
+        std::string name = "s" + std::to_string(i);
+        std::string data = RandomSequence(1 + i % 97, i);
+        expected.push_back(name);
+        fasta += ">" + name + "\n" + data.substr(0, data.size() / 2) + "\n" +
+                 data.substr(data.size() / 2) + "\n";
+        fastq += "@" + name + "\n" + data + "\n+\n" +
+                 std::string(data.size(), '@') + "\n";
+    }
+
+    ivory::ThreadPool thread_pool(4);
+    for (auto& content : {fasta, fastq}) {
+        std::string path = TemporaryFile(content, false);
+        ivory::SequenceReader reader(path);
+        ivory::SequenceChunk chunk = reader.ParseAll(&thread_pool);
+        EXPECT_EQ(Names(chunk), expected);
+        EXPECT_EQ(chunk.sequences[96].data_len, 97);
+        EXPECT_TRUE(reader.Parse(1).sequences.empty());
+        unlink(path.c_str());
+    }
+}
+
+// Test that packed windows match the original sequence on both strands
+TEST(ReferenceTest, Extract) {
+    std::string data = RandomSequence(1000, 11);
+    for (unsigned int i = 100; i < 140; i++)
+        data[i] = 'N';
+    for (unsigned int i = 130; i < 300; i++)
+        data[i] = tolower(data[i]);
+    data[500] = 'R';
+    std::string other = RandomSequence(77, 12);
+
+    ivory::ReferenceStore store;
+    store.Add({"first", 5, other.data(), 77, nullptr, 0});
+    store.Add({"second", 6, data.data(), 1000, nullptr, 0});
+    EXPECT_EQ(store.size(), 2);
+    EXPECT_EQ(std::string(store.view(1).name, store.view(1).name_len),
+              "second");
+    EXPECT_EQ(store.view(1).data_len, 1000);
+    EXPECT_LT(store.memory_usage(), 1077 / 4 + 64);
+
+    data[500] = 'N';
+    std::string window;
+    store.Extract(0, 0, 77, true, &window);
+    EXPECT_EQ(window, other);
+    std::mt19937 generator(13);
+    for (int i = 0; i < 200; i++) {
+        std::uint32_t begin = generator() % 1000;
+        std::uint32_t end = begin + generator() % (1001 - begin);
+        std::string expected = data.substr(begin, end - begin);
+        store.Extract(1, begin, end, true, &window);
+        EXPECT_EQ(window, expected);
+
+        store.Extract(1, begin, end, false, &window);
+        std::string upper = expected;
+        for (auto& c : upper)
+            c = toupper(c);
+        std::string rc = ivory::ReverseComplement(upper);
+        ASSERT_EQ(window.size(), rc.size());
+        for (std::size_t j = 0; j < rc.size(); j++) {
+            EXPECT_EQ(toupper(window[j]), rc[j]);
+            EXPECT_EQ(islower(window[j]) != 0,
+                      islower(expected[expected.size() - 1 - j]) != 0);
+        }
+    }
+}
+
+// Test gzip compressed FASTQ streamed through a pipe
+TEST(ReaderTest, Descriptor) {
+    std::string path = TemporaryFile("@a\nACGT\n+\nIIII\n@b\nGG\n+\nII\n",
+                                     true);
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    std::thread writer([&] () {
+        std::string content;
+        std::ifstream file(path, std::ios::binary);
+        content.assign(std::istreambuf_iterator<char>(file),
+                       std::istreambuf_iterator<char>());
+        EXPECT_EQ(write(fds[1], content.data(), content.size()),
+                  static_cast<ssize_t>(content.size()));
+        close(fds[1]);
+    });
+
+    ivory::SequenceReader reader(fds[0]);
+    EXPECT_FALSE(reader.is_mapped());
+    EXPECT_TRUE(reader.is_fastq());
+    ivory::SequenceChunk chunk = reader.Parse(-1);
+    writer.join();
+    EXPECT_EQ(Names(chunk), std::vector<std::string>({"a", "b"}));
+    EXPECT_EQ(std::string(chunk.sequences[1].quality,
+                          chunk.sequences[1].quality_len), "II");
+    EXPECT_TRUE(reader.Parse(-1).sequences.empty());
+    unlink(path.c_str());
+}
+
+// Test length statistics past the 32-bit range and of empty input
+TEST(StatisticsTest, Lengths) {
+    ivory::LengthStatistics empty;
+    EXPECT_EQ(empty.num_sequences(), 0);
+    EXPECT_EQ(empty.min_length(), 0);
+    EXPECT_EQ(empty.mean_length(), 0);
+    EXPECT_EQ(empty.Nx(0.5), 0);
+
+    ivory::LengthStatistics stats, other;
+    for (int i = 0; i < 3; i++)
+        stats.Add(1ULL << 31);
+    stats.Add(100);
+    other.Add(5ULL << 31);
+    other.Add(10);
+    stats.Merge(other);
+    EXPECT_EQ(stats.num_sequences(), 6);
+    EXPECT_EQ(stats.total_length(), (8ULL << 31) + 110);
+    EXPECT_EQ(stats.min_length(), 10);
+    EXPECT_EQ(stats.max_length(), 5ULL << 31);
+    EXPECT_EQ(stats.mean_length(), ((8ULL << 31) + 110) / 6);
+    EXPECT_EQ(stats.Nx(0.5), 5ULL << 31);
+    EXPECT_EQ(stats.Nx(0.9), 1ULL << 31);
+    EXPECT_EQ(stats.Nx(1.0), 10);
+    EXPECT_EQ(stats.NGx(0.5, 100ULL << 31), 0);
+    EXPECT_EQ(stats.NGx(0.5, 12ULL << 31), 1ULL << 31);
+}
+
+// Test that counters and latencies of all threads are collected, and that
+// the latency percentiles stay within the histogram resolution
+TEST(ProfileTest, CountersAndLatencies) {
+    ivory::ProfileReport before = ivory::CollectProfile();
+    ivory::ProfileAdd(ivory::kAnchors, 5);
+    std::thread worker([] () {
+        ivory::ProfileAdd(ivory::kAnchors, 7);
+        ivory::ProfileStageTime(ivory::kChainStage, 2000, 1000);
+        for (std::uint64_t i = 1; i <= 1000; i++)
+            ivory::ProfileReadLatency("read", 4, i * 1000);
+        ivory::ProfileReadLatency("slow\"read", 9, 1ULL << 40);
+    });
+    worker.join();
+
+    // Counters of finished threads are kept
+    ivory::ProfileReport report = ivory::CollectProfile();
+    EXPECT_EQ(report.counters[ivory::kAnchors] -
+              before.counters[ivory::kAnchors], 12);
+    EXPECT_EQ(report.wall_ns[ivory::kChainStage] -
+              before.wall_ns[ivory::kChainStage], 2000);
+    EXPECT_EQ(report.cpu_ns[ivory::kChainStage] -
+              before.cpu_ns[ivory::kChainStage], 1000);
+    EXPECT_EQ(report.num_reads - before.num_reads, 1001);
+    EXPECT_EQ(report.max_latency_ns, 1ULL << 40);
+
+    // Percentiles are within 1/8 above the exact value
+    std::uint64_t p50 = report.LatencyPercentile(0.5);
+    EXPECT_GE(p50, 500000);
+    EXPECT_LE(p50, 500000 + 500000 / 8);
+    std::uint64_t p99 = report.LatencyPercentile(0.99);
+    EXPECT_GE(p99, 990000);
+    EXPECT_LE(p99, 990000 + 990000 / 8);
+    EXPECT_EQ(report.LatencyPercentile(1.0), 1ULL << 40);
+
+    ASSERT_EQ(report.slowest_reads.size(), 10);
+    EXPECT_EQ(report.slowest_reads[0].first, 1ULL << 40);
+    EXPECT_EQ(report.slowest_reads[0].second, "slow\"read");
+    EXPECT_EQ(report.slowest_reads[1].first, 1000000);
+    EXPECT_EQ(report.slowest_reads[9].first, 992000);
+
+    EXPECT_GT(ivory::PeakRss(), 0);
+}
+
+// Test requests and their responses over a Unix domain socket, and that the
+// server stops and removes the socket
+TEST(ServerTest, Request) {
+    char directory[] = "/tmp/ivory_server_XXXXXX";
+    ASSERT_NE(mkdtemp(directory), nullptr);
+    std::string path = std::string(directory) + "/socket";
+
+    std::unique_ptr<ivory::UnixServer> server(new ivory::UnixServer(path));
+    EXPECT_THROW(ivory::UnixServer other(path), std::runtime_error);
+    std::thread thread([&server] () {
+        server->Serve([] (int fd) {
+            std::string request;
+            char buffer[4];
+            ssize_t n;
+            while ((n = read(fd, buffer, sizeof(buffer))) > 0)
+                request.append(buffer, n);
+            // Connections without a request probe whether the server is live
+            if (request.empty()) {
+                close(fd);
+                return;
+            }
+            for (auto& c : request)
+                c = toupper(c);
+            EXPECT_EQ(write(fd, request.data(), request.size()),
+                      static_cast<ssize_t>(request.size()));
+            ivory::SendResponseEnd(fd, request.size() > 8 ? "too long" : "");
+            close(fd);
+        }, 2);
+    });
+
+    auto request = [&path] (const std::string& content, std::string* error) {
+        std::string input = TemporaryFile(content, false);
+        std::string output = TemporaryFile("", false);
+        int input_fd = open(input.c_str(), O_RDONLY);
+        int output_fd = open(output.c_str(), O_WRONLY);
+        int socket = ivory::ConnectUnix(path);
+        ivory::SendRequest(input_fd, socket);
+        {
+            ivory::OutputWriter writer(output_fd);
+            *error = ivory::ReceiveResponse(socket, &writer);
+        }
+        close(socket);
+        close(input_fd);
+        close(output_fd);
+
+        std::ifstream file(output);
+        std::string response((std::istreambuf_iterator<char>(file)),
+                             std::istreambuf_iterator<char>());
+        unlink(input.c_str());
+        unlink(output.c_str());
+        return response;
+    };
+    std::string error;
+    EXPECT_EQ(request(">a\nacgt", &error), ">A\nACGT");
+    EXPECT_EQ(error, "");
+    EXPECT_EQ(request(">a\nacgtacgt", &error), ">A\nACGTACGT");
+    EXPECT_EQ(error, "too long");
+
+    EXPECT_THROW(ivory::ConnectUnix(std::string(directory) + "/missing"),
+                 std::runtime_error);
+    server->Stop();
+    thread.join();
+    server.reset();
+    EXPECT_NE(access(path.c_str(), F_OK), 0);
+    EXPECT_EQ(rmdir(directory), 0);
+}
+
+// Test that a microsatellite in a random sequence is masked, while the
+// rest and runs split by N are treated on their own
+TEST(DustTest, LowComplexity) {
+    std::mt19937 generator(7);
+    std::string sequence(500, 'A');
+    for (auto& c : sequence)
+        c = "ACGT"[generator() % 4];
+    EXPECT_TRUE(ivory::Dust(sequence.c_str(), sequence.size()).empty());
+
+    for (int i = 200; i < 280; i += 2)
+        sequence.replace(i, 2, "CA");
+    auto masked = ivory::Dust(sequence.c_str(), sequence.size());
+    ASSERT_EQ(masked.size(), 1);
+    EXPECT_GE(masked[0].first, 195);
+    EXPECT_LE(masked[0].first, 201);
+    EXPECT_GE(masked[0].second, 279);
+    EXPECT_LE(masked[0].second, 285);
+    EXPECT_TRUE(ivory::Dust(sequence.c_str(), sequence.size(), 1000).empty());
+
+    std::string runs = std::string(20, 'A') + "N" + std::string(20, 'T');
+    masked = ivory::Dust(runs.c_str(), runs.size());
+    ASSERT_EQ(masked.size(), 2);
+    EXPECT_EQ(masked[0], std::make_pair(0U, 20U));
+    EXPECT_EQ(masked[1], std::make_pair(21U, 41U));
+}
+
+// Test that overlaps are matched one to one within epsilon on the same
+// target and strand
+TEST(EvaluationTest, MatchOverlaps) {
+    std::string query;
+    ivory::PafOverlap overlap;
+    std::string line = "r1\t1000\t10\t990\t-\tchr1\t50000\t2000\t2980\t970";
+    ASSERT_TRUE(ivory::ParsePafLine(line.c_str(), line.size(), &query,
+                                    &overlap));
+    EXPECT_EQ(query, "r1");
+    EXPECT_EQ(overlap.target, "chr1");
+    EXPECT_FALSE(overlap.strand);
+    EXPECT_EQ(overlap.q_begin, 10);
+    EXPECT_EQ(overlap.q_end, 990);
+    EXPECT_EQ(overlap.t_begin, 2000);
+    EXPECT_EQ(overlap.t_end, 2980);
+    line = "r1\t1000\t10\t990\t-\tchr1\t50000\t2000";
+    EXPECT_FALSE(ivory::ParsePafLine(line.c_str(), line.size(), &query,
+                                     &overlap));
+
+    std::vector<ivory::PafOverlap> baseline = {
+        {"chr1", true, 0, 1000, 5000, 6000},
+        {"chr1", true, 0, 1000, 5050, 6050},
+        {"chr2", true, 0, 1000, 5000, 6000}
+    };
+    std::vector<ivory::PafOverlap> compared = {
+        {"chr1", true, 20, 990, 5030, 6010},
+        {"chr1", true, 0, 1000, 5010, 6000},
+        {"chr1", false, 0, 1000, 5000, 6000},
+        {"chr2", true, 0, 1000, 5200, 6000}
+    };
+    EXPECT_EQ(ivory::MatchOverlaps(baseline, compared, 100), 2);
+    EXPECT_EQ(ivory::MatchOverlaps(baseline, compared, 5), 0);
+    EXPECT_EQ(ivory::MatchOverlaps(baseline, compared, 200), 3);
+}
+
+// Test that reads missing from either file are counted and that the
+// mismatched reads are listed
+TEST(EvaluationTest, ComparePaf) {
+    std::string baseline = TemporaryFile(
+            "a\t100\t0\t100\t+\tt\t1000\t0\t100\t100\n"
+            "a\t100\t0\t50\t+\tt\t1000\t500\t550\t50\n"
+            "b\t100\t0\t100\t-\tt\t1000\t200\t300\t100\n"
+            "c\t100\t0\t100\t+\tt\t1000\t300\t400\t100\n", true);
+    std::string compared = TemporaryFile(
+            "a\t100\t0\t100\t+\tt\t1000\t5\t100\t100\n"
+            "c\t100\t0\t100\t+\tt\t1000\t300\t400\t100\n"
+            "d\t100\t0\t100\t+\tt\t1000\t600\t700\t100\n", false);
+
+    std::ostringstream mismatches;
+    ivory::Evaluation evaluation = ivory::ComparePaf(baseline, compared, 10,
+                                                     &mismatches);
+    EXPECT_EQ(evaluation.baseline_overlaps, 4);
+    EXPECT_EQ(evaluation.compared_overlaps, 3);
+    EXPECT_EQ(evaluation.matched_overlaps, 2);
+    EXPECT_EQ(evaluation.baseline_reads, 3);
+    EXPECT_EQ(evaluation.compared_reads, 3);
+    EXPECT_EQ(evaluation.baseline_only_reads, 1);
+    EXPECT_EQ(evaluation.compared_only_reads, 1);
+    EXPECT_EQ(evaluation.mismatched_reads, 3);
+    EXPECT_DOUBLE_EQ(evaluation.jaccard(), 2.0 / 5);
+    EXPECT_EQ(mismatches.str(), "a\t2\t1\t1\nb\t1\t0\t0\nd\t0\t1\t0\n");
+
+    evaluation = ivory::ComparePaf(baseline, baseline, 0, nullptr);
+    EXPECT_EQ(evaluation.matched_overlaps, 4);
+    EXPECT_EQ(evaluation.mismatched_reads, 0);
+    EXPECT_DOUBLE_EQ(evaluation.jaccard(), 1.0);
+    EXPECT_THROW(ivory::ComparePaf(baseline, "/nonexistent.paf", 0, nullptr),
+                 std::invalid_argument);
+
+    // Lines of a query split by another one, as in all-vs-all output of
+    // several index blocks
+    std::string split = TemporaryFile(
+            "a\t100\t0\t100\t+\tt\t1000\t0\t100\t100\n"
+            "b\t100\t0\t100\t-\tt\t1000\t200\t300\t100\n"
+            "a\t100\t0\t50\t+\tt\t1000\t500\t550\t50\n", false);
+    EXPECT_THROW(ivory::ComparePaf(baseline, split, 0, nullptr),
+                 std::runtime_error);
+    unlink(baseline.c_str());
+    unlink(compared.c_str());
+    unlink(split.c_str());
+}
+
+// Test that reads missing from one file every other read stay within a
+// small pending limit, while a longer run of them overflows it
+TEST(EvaluationTest, ComparePafPending) {
+    auto line = [] (const std::string& query) {
+        return query + "\t100\t0\t100\t+\tt\t1000\t0\t100\t100\n";
+    };
+    std::string interleaved, run, common;
+    for (int i = 0; i < 50; i++) {
+        interleaved += line("x" + std::to_string(i)) +
+                line("c" + std::to_string(i));
+        run += line("x" + std::to_string(i));
+        common += line("c" + std::to_string(i));
+    }
+    run += common;
+    std::string interleaved_path = TemporaryFile(interleaved, false);
+    std::string run_path = TemporaryFile(run, false);
+    std::string common_path = TemporaryFile(common, false);
+
+    ivory::Evaluation evaluation = ivory::ComparePaf(
+            interleaved_path, common_path, 0, nullptr, 4);
+    EXPECT_EQ(evaluation.overflow_reads, 0);
+    EXPECT_EQ(evaluation.matched_overlaps, 50);
+    EXPECT_EQ(evaluation.baseline_only_reads, 50);
+    evaluation = ivory::ComparePaf(common_path, interleaved_path, 0, nullptr,
+                                   4);
+    EXPECT_EQ(evaluation.overflow_reads, 0);
+    EXPECT_EQ(evaluation.compared_only_reads, 50);
+
+    evaluation = ivory::ComparePaf(run_path, common_path, 0, nullptr, 4);
+    EXPECT_GT(evaluation.overflow_reads, 0);
+    evaluation = ivory::ComparePaf(run_path, common_path, 0, nullptr, 100);
+    EXPECT_EQ(evaluation.overflow_reads, 0);
+    EXPECT_EQ(evaluation.matched_overlaps, 50);
+    unlink(interleaved_path.c_str());
+    unlink(run_path.c_str());
+    unlink(common_path.c_str());
+}